@@ -124,6 +124,7 @@ void PixelPunchApp::initOptions()
 	mSamplingOptions[pp::SAMPLE_BEST_FIT_WIDE] = "Best Fit Wide";
 	mSamplingOptions[pp::SAMPLE_BEST_FIT_ANY] = "Best Fit Any";
 	mSamplingOptions[pp::SAMPLE_MINIMIZE_ERROR] = "Bilinear Mix";
+	mSamplingOptions[pp::SAMPLE_ROTSPRITE] = "RotSprite";
 	mSamplingMethod = pp::SAMPLE_NEAREST;
 }
 
@@ -276,12 +277,11 @@ void PixelPunchApp::validateResultImage()
 				case pp::SAMPLE_SECOND_WEIGHT:
 					mResultImage = pp::transform(pp::WeightSampler(mScaledSrc, 1), tfx, mTransformMethod);
 					break;
+				case pp::SAMPLE_ROTSPRITE:
+					mResultImage = pp::transform(pp::RotSpriteSampler(mScaledSrc), tfx, mTransformMethod);
+					break;
 				case pp::SAMPLE_MINIMIZE_ERROR:
-					Surface bicubic = pp::transform(pp::BicubicSampler(mScaledSrc), tfx, mTransformMethod);
-					Surface first = pp::transform(pp::BilinearDominanceSampler(mScaledSrc, 0), tfx, mTransformMethod);
-					Surface second = pp::transform(pp::BilinearDominanceSampler(mScaledSrc, 1), tfx, mTransformMethod);
-					Surface secondWeight = pp::transform(pp::WeightSampler(mScaledSrc, 1), tfx, mTransformMethod);
-					mResultImage = pp::choose(first, second, pp::compare(bicubic, first), secondWeight, mMixThreshold*mMixThreshold);
+					mResultImage = pp::mix(pp::BilinearMixSampler(mScaledSrc), tfx, mTransformMethod, mMixThreshold*mMixThreshold);
 			}
 			if(mDiffWithSmoothBicubic)
 			{
@@ -0,0 +1,83 @@
+#include "PixelPunch.h"
+#include "EqualityPlanes.h"
+#include <algorithm>
+
+#ifdef PP_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace pp;
+
+uint64_t _equalBits(const uint32_t* a, const uint32_t* b, int count)
+{
+	uint64_t bits = 0;
+	int i = 0;
+#ifdef PP_SSE2
+	for(; i + 4 <= count; i += 4)
+	{
+		__m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+		bits |= uint64_t(_mm_movemask_ps(_mm_castsi128_ps(eq))) << i;
+	}
+#endif
+	for(; i < count; i++)
+		if(a[i] == b[i])
+			bits |= uint64_t(1) << i;
+	return bits;
+}
+
+uint64_t _equalBits(const uint8_t* a, const uint8_t* b, int count)
+{
+	uint64_t bits = 0;
+	int i = 0;
+#ifdef PP_SSE2
+	for(; i + 16 <= count; i += 16)
+	{
+		__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+		bits |= uint64_t(_mm_movemask_epi8(eq)) << i;
+	}
+#endif
+	for(; i < count; i++)
+		if(a[i] == b[i])
+			bits |= uint64_t(1) << i;
+	return bits;
+}
+
+EqualityPlanes::EqualityPlanes(const uint32_t* const* rows, int x, int y, int count)
+:	mRows(rows),
+	mIndices(NULL),
+	mX(x),
+	mY(y),
+	mCount(count),
+	mCached(0)
+{
+}
+
+EqualityPlanes::EqualityPlanes(const uint8_t* const* rows, int x, int y, int count)
+:	mRows(NULL),
+	mIndices(rows),
+	mX(x),
+	mY(y),
+	mCount(count),
+	mCached(0)
+{
+}
+
+uint64_t EqualityPlanes::operator()(int ax, int ay, int bx, int by)
+{
+	//equality is symmetric, so (a, b) and (b, a) share a plane
+	int a = (ay + 2) * 5 + ax + 2;
+	int b = (by + 2) * 5 + bx + 2;
+	int key = std::min(a, b) * 25 + std::max(a, b);
+	for(int i = 0; i < mCached; i++)
+		if(mKeys[i] == key)
+			return mPlanes[i];
+
+	uint64_t plane = mRows ? _equalBits(mRows[mY + ay] + mX + ax, mRows[mY + by] + mX + bx, mCount)
+		: _equalBits(mIndices[mY + ay] + mX + ax, mIndices[mY + by] + mX + bx, mCount);
+	if(mCached < CacheSize)
+	{
+		mKeys[mCached] = key;
+		mPlanes[mCached++] = plane;
+	}
+	return plane;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "cinder/Cinder.h"
+
+namespace pp
+{
+	/*
+	Equality bitplanes for a run of up to 64 pixels of one row of a packed or indexed image. Bit i of a plane tells
+	whether the pixels at two offsets from pixel (x + i, y) are equal, so a pattern rule made of "equals"
+	and "differs" relations is evaluated for the whole run with a few AND/ANDNOT operations, e.g.
+
+		planes(-1,0, 0,-1) & planes(-1,0, 1,0) & ~planes(-1,0, 0,0)
+
+	is set where the left neighbour equals the top and the right neighbour but not the center pixel.
+	Each plane is computed once per run, whichever order its offsets are given in. Offsets must lie
+	within [-2, 2] and every pixel they reach has to be inside the image.
+	*/
+	class EqualityPlanes
+	{
+	public:
+		EqualityPlanes(const uint32_t* const* rows, int x, int y, int count);
+		EqualityPlanes(const uint8_t* const* rows, int x, int y, int count);
+		uint64_t operator()(int ax, int ay, int bx, int by);
+		//bits of the pixels in the run
+		uint64_t all() const { return mCount == 64 ? ~uint64_t(0) : (uint64_t(1) << mCount) - 1; }
+
+	private:
+		enum { CacheSize = 32 };
+
+		//one of them is set
+		const uint32_t* const* mRows;
+		const uint8_t* const* mIndices;
+		int mX;
+		int mY;
+		int mCount;
+		int mCached;
+		int mKeys[CacheSize];
+		uint64_t mPlanes[CacheSize];
+	};
+}
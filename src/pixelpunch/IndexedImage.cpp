@@ -0,0 +1,160 @@
+#include "IndexedImage.h"
+#include "LineBuffer.h"
+#include "Parallel.h"
+#include <algorithm>
+
+using namespace pp;
+using namespace cinder;
+
+//rows of the source each task of assign() converts
+const int INDEX_BAND = 64;
+//the most colors an IndexedImage can have
+const int MAX_COLORS = 256;
+//marks the unused slots of a ColorIndex, packed colors never have the upper byte set
+const uint32_t NO_COLOR = 0xFFFFFFFF;
+
+//open addressing hash table from packed colors to palette indices, kept at most half full
+struct ColorIndex
+{
+	ColorIndex() : keys(2 * MAX_COLORS, NO_COLOR), values(2 * MAX_COLORS, 0), size(0) {}
+	int find(uint32_t color) const
+	{
+		//the upper 9 bits pick one of the 512 slots
+		uint32_t slot = (color * 2654435761u) >> 23;
+		while(keys[slot] != NO_COLOR && keys[slot] != color)
+			slot = (slot + 1) & (2 * MAX_COLORS - 1);
+		return slot;
+	}
+	//index of color, -1 once there would be more than MAX_COLORS colors
+	int add(uint32_t color)
+	{
+		int slot = find(color);
+		if(keys[slot] != NO_COLOR)
+			return values[slot];
+		if(size == MAX_COLORS)
+			return -1;
+		keys[slot] = color;
+		values[slot] = (uint8_t)size;
+		return size++;
+	}
+	std::vector<uint32_t> keys;
+	std::vector<uint8_t> values;
+	int size;
+};
+
+IndexedImage::IndexedImage() : mWidth(0), mHeight(0)
+{
+}
+
+bool IndexedImage::assign(Surface& source)
+{
+	int width = source.getWidth();
+	int height = source.getHeight();
+	mData.clear();
+	mRows.clear();
+	mPalette.clear();
+	mWidth = mHeight = 0;
+	if(width == 0 || height == 0)
+		return false;
+	int stride = width + 2;
+	mData.resize(height * stride);
+	mRows.resize(height);
+	for(int y = 0; y < height; y++)
+		mRows[y] = &mData[y * stride + 1];
+
+	//each band numbers its colors on its own, a band with too many colors stops early
+	int bands = (height + INDEX_BAND - 1) / INDEX_BAND;
+	std::vector<ColorIndex> found(bands);
+	std::vector<char> tooMany(bands, 0);
+	parallelFor(bands, [&](int band)
+	{
+		ColorIndex& colors = found[band];
+		std::vector<uint32_t> row(width);
+		for(int y = band * INDEX_BAND; y < std::min(height, (band + 1) * INDEX_BAND); y++)
+		{
+			packRow(source, y, &row[0]);
+			uint8_t* dest = mRows[y];
+			//no shortcut for runs of the same color, in a table this sparse the first slot nearly always
+			//holds the color already which is cheaper than a mispredicted branch
+			for(int x = 0; x < width; x++)
+			{
+				int index = colors.add(row[x]);
+				if(index < 0)
+				{
+					tooMany[band] = 1;
+					return;
+				}
+				dest[x] = (uint8_t)index;
+			}
+		}
+	});
+
+	//then the numbers of all bands are mapped onto a shared palette
+	ColorIndex colors;
+	std::vector<uint8_t> remap(bands * MAX_COLORS);
+	std::vector<char> identity(bands, 1);
+	for(int band = 0; band < bands; band++)
+	{
+		if(tooMany[band])
+			break;
+		for(size_t i = 0; i < found[band].keys.size(); i++)
+			if(found[band].keys[i] != NO_COLOR)
+			{
+				int shared = colors.add(found[band].keys[i]);
+				if(shared < 0)
+				{
+					tooMany[band] = 1;
+					break;
+				}
+				uint8_t local = found[band].values[i];
+				remap[band * MAX_COLORS + local] = (uint8_t)shared;
+				identity[band] &= (shared == local);
+			}
+		if(tooMany[band])
+			break;
+	}
+	if(std::find(tooMany.begin(), tooMany.end(), 1) != tooMany.end())
+	{
+		mData.clear();
+		mRows.clear();
+		return false;
+	}
+
+	mPalette.resize(colors.size);
+	for(size_t i = 0; i < colors.keys.size(); i++)
+		if(colors.keys[i] != NO_COLOR)
+			mPalette[colors.values[i]] = colors.keys[i];
+	parallelFor(bands, [&](int band)
+	{
+		const uint8_t* map = &remap[band * MAX_COLORS];
+		for(int y = band * INDEX_BAND; y < std::min(height, (band + 1) * INDEX_BAND); y++)
+		{
+			uint8_t* dest = mRows[y];
+			if(!identity[band])
+				for(int x = 0; x < width; x++)
+					dest[x] = map[dest[x]];
+			dest[-1] = dest[0];
+			dest[width] = dest[width - 1];
+		}
+	});
+	mWidth = width;
+	mHeight = height;
+	return true;
+}
+
+void IndexedImage::unpackRow(const uint8_t* src, Surface& surf, int y) const
+{
+	uint8_t* dest = surf.getData(Vec2i(0, y));
+	int inc = surf.getPixelInc();
+	int r = surf.getRedOffset();
+	int g = surf.getGreenOffset();
+	int b = surf.getBlueOffset();
+	int width = surf.getWidth();
+	for(int x = 0; x < width; x++, dest += inc)
+	{
+		uint32_t color = mPalette[src[x]];
+		dest[r] = 0xFF & (color >> 16);
+		dest[g] = 0xFF & (color >> 8);
+		dest[b] = 0xFF &  color;
+	}
+}
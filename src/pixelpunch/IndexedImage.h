@@ -0,0 +1,54 @@
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/Surface.h"
+#include "cinder/CinderMath.h"
+#include <vector>
+
+namespace pp
+{
+	/*
+	An image as 8-bit indices into a palette of at most 256 packed 0x00RRGGBB colors, which is plenty for
+	pixel art. Scalers that only compare and copy pixels give the same result on the indices as on the
+	colors while moving a quarter of the data. Rows are padded with copies of their first and last index
+	and row() clamps y, so the neighbourhood of any pixel can be read without further bounds checks.
+	*/
+	class IndexedImage
+	{
+	public:
+		IndexedImage();
+		//false if source has more than 256 colors (the image is left empty then), alpha is ignored
+		bool assign(cinder::Surface& source);
+		//valid from x = -1 to x = width
+		const uint8_t* row(int y) const { return mRows[cinder::constrain(y, 0, mHeight - 1)]; }
+		//write the colors of a row of indices into the RGB channels of a surface row, alpha is left untouched
+		void unpackRow(const uint8_t* src, cinder::Surface& surf, int y) const;
+		const std::vector<uint32_t>& palette() const { return mPalette; }
+		int width() const { return mWidth; }
+		int height() const { return mHeight; }
+
+	private:
+		std::vector<uint8_t> mData;
+		std::vector<uint8_t*> mRows;
+		std::vector<uint32_t> mPalette;
+		int mWidth;
+		int mHeight;
+	};
+
+	//steps through the rows of an IndexedImage like a LineBuffer does through a surface, without copying them
+	class IndexedLines
+	{
+	public:
+		IndexedLines(const IndexedImage& image, int rowsAbove, int rowsBelow) : mImage(image), mY(0) {}
+		bool seek(int y) { mY = y; return mY < mImage.height(); }
+		bool next() { return ++mY < mImage.height(); }
+		const uint8_t* row(int offset) const { return mImage.row(mY + offset); }
+		int y() const { return mY; }
+		int width() const { return mImage.width(); }
+		int height() const { return mImage.height(); }
+
+	private:
+		const IndexedImage& mImage;
+		int mY;
+	};
+}
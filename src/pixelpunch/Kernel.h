@@ -1,30 +1,110 @@
 #pragma once
 
 #include "cinder/Cinder.h"
-#include "cinder/Surface.h"
-#include "cinder/Area.h"
+#include "cinder/CinderMath.h"
 
-namespace pp 
+namespace pp
 {
+	/*
+	A WxH block of pixels around a center at (CX, CY), packed 0x00RRGGBB or palette indices (see IndexedImage).
+	The size is known at compile time so the pixels live inline, row by row, and all loops over them can be
+	unrolled.
+
+	read() and write() address a whole packed image and clamp at its borders. load(), store() and step()
+	take the H rows the block covers (the row at y - CY first) and expect them to be padded as far as
+	the block reaches to the left and right (see LineBuffer).
+	*/
+	template<int W, int H, int CX = 0, int CY = 0, class P = uint32_t>
 	class Kernel
 	{
 	public:
-		Kernel(cinder::Surface& source, int width, int height, int centerX = 0, int centerY = 0);
-		~Kernel();
-		bool step(int stepsH, int stepsV);
-		bool read(int steps = 1);
-		bool write(int steps = 1);
-		bool copy(const Kernel& from);
-		cinder::Surface::Iter& iter() { return mIter; }
-		uint32_t** pixels;
+		enum { Width = W, Height = H, CenterX = CX, CenterY = CY };
+		typedef P Pixel;
+
+		P& operator()(int x, int y) { return mPixels[y * W + x]; }
+		P operator()(int x, int y) const { return mPixels[y * W + x]; }
+		//row-major index
+		P& operator[](int i) { return mPixels[i]; }
+		P operator[](int i) const { return mPixels[i]; }
+
+		void read(const P* const* rows, int width, int height, int cx, int cy)
+		{
+			int left = cx - CX;
+			int top = cy - CY;
+			if(inside(width, height, left, top))
+			{
+				for(int y = 0; y < H; y++)
+					for(int x = 0; x < W; x++)
+						(*this)(x, y) = rows[top + y][left + x];
+				return;
+			}
+			int px[W];
+			int py[H];
+			clamp(width, height, left, top, px, py);
+			for(int y = 0; y < H; y++)
+				for(int x = 0; x < W; x++)
+					(*this)(x, y) = rows[py[y]][px[x]];
+		}
+
+		void write(P* const* rows, int width, int height, int cx, int cy) const
+		{
+			int left = cx - CX;
+			int top = cy - CY;
+			if(inside(width, height, left, top))
+			{
+				for(int y = 0; y < H; y++)
+					for(int x = 0; x < W; x++)
+						rows[top + y][left + x] = (*this)(x, y);
+				return;
+			}
+			//when several cells are clamped onto the same pixel the one written last wins, column by column
+			int px[W];
+			int py[H];
+			clamp(width, height, left, top, px, py);
+			for(int x = 0; x < W; x++)
+				for(int y = 0; y < H; y++)
+					rows[py[y]][px[x]] = (*this)(x, y);
+		}
+
+		void load(const P* const* lines, int cx)
+		{
+			for(int y = 0; y < H; y++)
+				for(int x = 0; x < W; x++)
+					(*this)(x, y) = lines[y][cx - CX + x];
+		}
+
+		void store(P* const* lines, int cx) const
+		{
+			for(int y = 0; y < H; y++)
+				for(int x = 0; x < W; x++)
+					lines[y][cx - CX + x] = (*this)(x, y);
+		}
+
+		//move the block from cx - 1 to cx, only the new rightmost column is fetched
+		void step(const P* const* lines, int cx)
+		{
+			for(int y = 0; y < H; y++)
+			{
+				for(int x = 0; x < W - 1; x++)
+					(*this)(x, y) = (*this)(x + 1, y);
+				(*this)(W - 1, y) = lines[y][cx - CX + W - 1];
+			}
+		}
 
 	private:
-		cinder::Surface::Iter mIter;
-		bool mHasAlpha;
-		bool mValid;
-		int mWidth;
-		int mHeight;
-		int mOffsetX;
-		int mOffsetY;
+		static bool inside(int width, int height, int left, int top)
+		{
+			return left >= 0 && top >= 0 && left + W <= width && top + H <= height;
+		}
+
+		static void clamp(int width, int height, int left, int top, int* px, int* py)
+		{
+			for(int x = 0; x < W; x++)
+				px[x] = cinder::constrain(left + x, 0, width - 1);
+			for(int y = 0; y < H; y++)
+				py[y] = cinder::constrain(top + y, 0, height - 1);
+		}
+
+		P mPixels[W * H];
 	};
 }
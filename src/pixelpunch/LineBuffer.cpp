@@ -0,0 +1,110 @@
+#include "LineBuffer.h"
+#include "cinder/CinderMath.h"
+#include <algorithm>
+
+using namespace pp;
+using namespace cinder;
+
+void pp::packRow(Surface& surf, int y, uint32_t* dest)
+{
+	const uint8_t* src = surf.getData(Vec2i(0, y));
+	int inc = surf.getPixelInc();
+	int r = surf.getRedOffset();
+	int g = surf.getGreenOffset();
+	int b = surf.getBlueOffset();
+	int width = surf.getWidth();
+	for(int x = 0; x < width; x++, src += inc)
+		dest[x] = (src[r] << 16) | (src[g] << 8) | src[b];
+}
+
+void pp::unpackRow(const uint32_t* src, Surface& surf, int y)
+{
+	uint8_t* dest = surf.getData(Vec2i(0, y));
+	int inc = surf.getPixelInc();
+	int r = surf.getRedOffset();
+	int g = surf.getGreenOffset();
+	int b = surf.getBlueOffset();
+	int width = surf.getWidth();
+	for(int x = 0; x < width; x++, dest += inc)
+	{
+		dest[r] = 0xFF & (src[x] >> 16);
+		dest[g] = 0xFF & (src[x] >> 8);
+		dest[b] = 0xFF &  src[x];
+	}
+}
+
+template<class P>
+void _pad(P* line, int width, int padding)
+{
+	for(int i = 1; i <= padding; i++)
+	{
+		line[-i] = line[0];
+		line[width - 1 + i] = line[width - 1];
+	}
+}
+
+LineBuffer::LineBuffer(Surface& source, int rowsAbove, int rowsBelow, int padding)
+:	mSource(source),
+	mRowsAbove(rowsAbove),
+	mPadding(padding),
+	mWidth(source.getWidth()),
+	mHeight(source.getHeight()),
+	mY(0)
+{
+	int rows = rowsAbove + 1 + rowsBelow;
+	int stride = mWidth + 2 * mPadding;
+	mData.resize(rows * stride);
+	mRows.resize(rows);
+	for(int i = 0; i < rows; i++)
+		mRows[i] = &mData[i * stride + mPadding];
+}
+
+void LineBuffer::load(uint32_t* line, int y)
+{
+	packRow(mSource, constrain(y, 0, mHeight - 1), line);
+	_pad(line, mWidth, mPadding);
+}
+
+bool LineBuffer::seek(int y)
+{
+	mY = y;
+	if(mY >= mHeight)
+		return false;
+
+	for(size_t i = 0; i < mRows.size(); i++)
+		load(mRows[i], mY - mRowsAbove + (int)i);
+	return true;
+}
+
+bool LineBuffer::next()
+{
+	if(++mY >= mHeight)
+		return false;
+
+	//the topmost row is no longer needed, reuse it for the new bottom row
+	std::rotate(mRows.begin(), mRows.begin() + 1, mRows.end());
+	load(mRows.back(), mY + (int)mRows.size() - 1 - mRowsAbove);
+	return true;
+}
+
+template<class P>
+RowRing<P>::RowRing(int width, int height, int capacity, int padding)
+:	mPadding(padding),
+	mWidth(width),
+	mHeight(height)
+{
+	int stride = mWidth + 2 * mPadding;
+	mData.resize(capacity * stride);
+	mRows.resize(mHeight);
+	for(int y = 0; y < mHeight; y++)
+		mRows[y] = &mData[(y % capacity) * stride + mPadding];
+}
+
+template<class P>
+void RowRing<P>::pad(int y)
+{
+	_pad(mRows[y], mWidth, mPadding);
+}
+
+template class pp::RowRing<uint32_t>;
+template class pp::RowRing<uint8_t>;
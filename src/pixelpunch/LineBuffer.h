@@ -0,0 +1,104 @@
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/Surface.h"
+#include "Kernel.h"
+#include <vector>
+
+namespace pp
+{
+	//pack the RGB channels of a surface row into 0x00RRGGBB pixels (the layout Kernel works on)
+	void packRow(cinder::Surface& surf, int y, uint32_t* dest);
+	//unpack a row of 0x00RRGGBB pixels into the RGB channels of a surface row, alpha is left untouched
+	void unpackRow(const uint32_t* src, cinder::Surface& surf, int y);
+
+	/*
+	Keeps the rows around a center row of the source packed in a ring buffer. Rows outside the
+	source are clamped when they get loaded and every row is padded with copies of its first and
+	last pixel, so the neighbourhood of any pixel can be read without further bounds checks.
+	*/
+	class LineBuffer
+	{
+	public:
+		LineBuffer(cinder::Surface& source, int rowsAbove, int rowsBelow, int padding = 1);
+		bool seek(int y);
+		bool next();
+		//the row at center + offset, valid from x = -padding to x = width + padding - 1
+		const uint32_t* row(int offset) const { return mRows[mRowsAbove + offset]; }
+		int y() const { return mY; }
+		int width() const { return mWidth; }
+		int height() const { return mHeight; }
+
+	private:
+		void load(uint32_t* line, int y);
+
+		cinder::Surface mSource;
+		std::vector<uint32_t> mData;
+		std::vector<uint32_t*> mRows;
+		int mRowsAbove;
+		int mPadding;
+		int mWidth;
+		int mHeight;
+		int mY;
+	};
+
+	/*
+	Rows of an intermediate image that is produced and consumed a few rows at a time. Only capacity rows
+	are stored, row(y) maps the absolute row index y onto them. Rows have the same padding as in a
+	LineBuffer but it is only filled in by pad(). P is uint32_t for packed pixels or uint8_t for indices.
+	*/
+	template<class P>
+	class RowRing
+	{
+	public:
+		RowRing(int width, int height, int capacity, int padding = 1);
+		P* row(int y) { return mRows[y]; }
+		P** rows() { return &mRows[0]; }
+		void pad(int y);
+		int width() const { return mWidth; }
+		int height() const { return mHeight; }
+
+	private:
+		std::vector<P> mData;
+		std::vector<P*> mRows;
+		int mPadding;
+		int mWidth;
+		int mHeight;
+	};
+
+	/*
+	A 3x3 Kernel sliding along a row, given the padded rows above, at and below it (see LineBuffer).
+	Moving one column to the right only fetches the new column.
+	*/
+	template<class P>
+	class SlidingWindow
+	{
+	public:
+		SlidingWindow(const P* above, const P* center, const P* below, int width) 
+		:	mWidth(width), mX(0)
+		{
+			mLines[0] = above;
+			mLines[1] = center;
+			mLines[2] = below;
+		}
+		void begin(int x = 0)
+		{
+			mX = x;
+			pixels.load(mLines, x);
+		}
+		bool slide()
+		{
+			if(++mX >= mWidth)
+				return false;
+			pixels.step(mLines, mX);
+			return true;
+		}
+		int x() const { return mX; }
+		Kernel<3, 3, 1, 1, P> pixels;
+
+	private:
+		const P* mLines[3];
+		int mWidth;
+		int mX;
+	};
+}
@@ -0,0 +1,128 @@
+#include "PaletteIndex.h"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+using namespace pp;
+using namespace cinder;
+
+//bits per channel that select a cell on each level, 3 bits make cells of 32x32x32 colors and 5 bits of 8x8x8
+const int CELL_BITS[2] = { 3, 5 };
+
+PaletteIndex::PaletteIndex(const Palette& colors) : mColors(colors.begin(), colors.end())
+{
+	for(size_t i = 0; i < mColors.size(); i++)
+	{
+		mRed.push_back(mColors[i].r);
+		mGreen.push_back(mColors[i].g);
+		mBlue.push_back(mColors[i].b);
+	}
+	for(int level = 0; level < 2; level++)
+	{
+		int count = 1 << (3 * CELL_BITS[level]);
+		mCells[level] = new std::atomic<const std::vector<int>*>[count];
+		for(int i = 0; i < count; i++)
+			mCells[level][i].store(NULL);
+	}
+}
+
+PaletteIndex::~PaletteIndex()
+{
+	for(int level = 0; level < 2; level++)
+	{
+		int count = 1 << (3 * CELL_BITS[level]);
+		for(int i = 0; i < count; i++)
+			delete mCells[level][i].load();
+		delete[] mCells[level];
+	}
+}
+
+int _nearestInRange(int v, int lo, int hi)
+{
+	return (v < lo) ? lo - v : (v > hi) ? v - hi : 0;
+}
+
+int _farthestInRange(int v, int lo, int hi)
+{
+	return std::max(std::abs(v - lo), std::abs(v - hi));
+}
+
+const std::vector<int>* PaletteIndex::fill(int level, int cell, const std::vector<int>* colors) const
+{
+	/*
+	No color in the cell is farther from its closest palette color than bound, the smallest of the largest
+	distances of each palette color to the cell. So palette colors that can't get closer than bound to any
+	point of the cell are never the closest one (or one tied with it) and can be left out.
+	That also holds for the colors left out of the coarser cell around it, so only those left in are checked.
+	*/
+	int bits = CELL_BITS[level];
+	int lo[3];
+	int hi[3];
+	for(int c = 0; c < 3; c++)
+	{
+		lo[c] = ((cell >> ((2 - c) * bits)) & ((1 << bits) - 1)) << (8 - bits);
+		hi[c] = lo[c] + (1 << (8 - bits)) - 1;
+	}
+	int count = colors ? (int)colors->size() : size();
+	std::vector<int> closest(count);
+	int bound = INT_MAX;
+	for(int k = 0; k < count; k++)
+	{
+		int i = colors ? (*colors)[k] : k;
+		int r = _nearestInRange(mRed[i], lo[0], hi[0]);
+		int g = _nearestInRange(mGreen[i], lo[1], hi[1]);
+		int b = _nearestInRange(mBlue[i], lo[2], hi[2]);
+		closest[k] = r*r + g*g + b*b;
+		r = _farthestInRange(mRed[i], lo[0], hi[0]);
+		g = _farthestInRange(mGreen[i], lo[1], hi[1]);
+		b = _farthestInRange(mBlue[i], lo[2], hi[2]);
+		bound = std::min(bound, r*r + g*g + b*b);
+	}
+	std::vector<int>* candidates = new std::vector<int>();
+	for(int k = 0; k < count; k++)
+		if(closest[k] <= bound)
+			candidates->push_back(colors ? (*colors)[k] : k);
+	//another thread may have filled the same cell in the meantime, theirs is just as good
+	const std::vector<int>* empty = NULL;
+	if(!mCells[level][cell].compare_exchange_strong(empty, candidates))
+	{
+		delete candidates;
+		return empty;
+	}
+	return candidates;
+}
+
+const std::vector<int>* PaletteIndex::candidates(const Color8u& color, int level) const
+{
+	int bits = CELL_BITS[level];
+	int shift = 8 - bits;
+	int cell = ((color.r >> shift) << (2 * bits)) | ((color.g >> shift) << bits) | (color.b >> shift);
+	const std::vector<int>* list = mCells[level][cell].load();
+	if(!list)
+		list = fill(level, cell, (level > 0) ? candidates(color, level - 1) : NULL);
+	return list;
+}
+
+int PaletteIndex::nearest(const Color8u& color) const
+{
+	const std::vector<int>* list = candidates(color, 1);
+	//candidates are in palette order, so ties are decided like in a search through the whole palette
+	int best = -1;
+	int bestError = INT_MAX;
+	for(size_t k = 0; k < list->size(); k++)
+	{
+		int i = (*list)[k];
+		int r = mRed[i] - color.r;
+		int g = mGreen[i] - color.g;
+		int b = mBlue[i] - color.b;
+		int error = r*r + g*g + b*b;
+		if(error < bestError)
+		{
+			best = i;
+			bestError = error;
+			if(error == 0)
+				break;
+		}
+	}
+	return best;
+}
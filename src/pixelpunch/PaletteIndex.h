@@ -0,0 +1,38 @@
+#pragma once
+
+#include "PixelPunch.h"
+#include <atomic>
+#include <vector>
+
+namespace pp
+{
+	/*
+	Finds the closest color of a palette without comparing against all of it. The RGB cube is split into
+	32x32x32 cells and each cell lists the colors that could be the closest to anything inside of it, only
+	those are compared. Cells are filled in when first looked up from the list of the 8x8x8 coarser cell
+	they are in. nearest() may be called from several threads at once. The palette is copied, later changes
+	to it are not picked up.
+	*/
+	class PaletteIndex
+	{
+	public:
+		PaletteIndex(const Palette& colors);
+		~PaletteIndex();
+		//position in the palette of the first of the colors closest to color, -1 if the palette is empty
+		int nearest(const cinder::Color8u& color) const;
+		const cinder::Color8u& color(int index) const { return mColors[index]; }
+		int size() const { return (int)mColors.size(); }
+
+	private:
+		PaletteIndex(const PaletteIndex&);
+		PaletteIndex& operator=(const PaletteIndex&);
+		const std::vector<int>* candidates(const cinder::Color8u& color, int level) const;
+		const std::vector<int>* fill(int level, int cell, const std::vector<int>* colors) const;
+
+		std::vector<cinder::Color8u> mColors;
+		std::vector<int> mRed;
+		std::vector<int> mGreen;
+		std::vector<int> mBlue;
+		std::atomic<const std::vector<int>*>* mCells[2]; //coarse and fine
+	};
+}
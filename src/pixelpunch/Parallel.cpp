@@ -0,0 +1,219 @@
+#include "Parallel.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <cstdint>
+
+using namespace pp;
+
+namespace
+{
+	class ThreadPool
+	{
+	public:
+		ThreadPool();
+		~ThreadPool();
+		int size() const { return (int)mWorkers.size() + 1; }
+		void run(int count, const std::function<void(int)>& task, bool steal);
+
+	private:
+		void work(int id);
+		void drain(int id);
+		bool pop(int id, int& index);
+		bool steal(int id);
+
+		std::vector<std::thread> mWorkers;
+		std::mutex mBusy;
+		std::mutex mMutex;
+		std::condition_variable mWake;
+		std::condition_variable mIdle;
+		const std::function<void(int)>* mTask;
+		int mCount;
+		std::atomic<int> mNext;
+		//per thread range of indices when stealing, begin in the low and end in the high 32 bits
+		std::unique_ptr<std::atomic<uint64_t>[]> mShares;
+		bool mSteal;
+		unsigned mGeneration;
+		int mActive;
+		bool mStop;
+	};
+
+	ThreadPool::ThreadPool()
+	:	mTask(NULL),
+		mCount(0),
+		mSteal(false),
+		mGeneration(0),
+		mActive(0),
+		mStop(false)
+	{
+		mNext = 0;
+		int threads = std::max(1, (int)std::thread::hardware_concurrency());
+		mShares.reset(new std::atomic<uint64_t>[threads]);
+		for(int i = 0; i < threads; i++)
+			mShares[i] = 0;
+		for(int i = 1; i < threads; i++)
+			mWorkers.push_back(std::thread(&ThreadPool::work, this, i));
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStop = true;
+		}
+		mWake.notify_all();
+		for(size_t i = 0; i < mWorkers.size(); i++)
+			mWorkers[i].join();
+	}
+
+	uint64_t _share(int begin, int end)
+	{
+		return (uint64_t)(uint32_t)begin | ((uint64_t)(uint32_t)end << 32);
+	}
+
+	void ThreadPool::run(int count, const std::function<void(int)>& task, bool steal)
+	{
+		if(count <= 1 || mWorkers.empty() || !mBusy.try_lock())
+		{
+			for(int i = 0; i < count; i++)
+				task(i);
+			return;
+		}
+		{
+			//workers that woke up late for the previous job must be gone before it gets replaced
+			std::unique_lock<std::mutex> lock(mMutex);
+			while(mActive > 0)
+				mIdle.wait(lock);
+			mTask = &task;
+			mCount = count;
+			mNext = 0;
+			mSteal = steal;
+			int threads = size();
+			for(int i = 0; i < threads; i++)
+				mShares[i] = _share((int)((int64_t)count * i / threads), (int)((int64_t)count * (i + 1) / threads));
+			++mGeneration;
+		}
+		mWake.notify_all();
+		drain(0);
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			while(mActive > 0)
+				mIdle.wait(lock);
+		}
+		mBusy.unlock();
+	}
+
+	void ThreadPool::work(int id)
+	{
+		unsigned seen = 0;
+		while(true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				while(!mStop && mGeneration == seen)
+					mWake.wait(lock);
+				if(mStop)
+					return;
+				seen = mGeneration;
+				++mActive;
+			}
+			drain(id);
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				--mActive;
+			}
+			mIdle.notify_all();
+		}
+	}
+
+	void ThreadPool::drain(int id)
+	{
+		if(!mSteal)
+		{
+			for(int i = mNext++; i < mCount; i = mNext++)
+				(*mTask)(i);
+			return;
+		}
+		int i;
+		do
+		{
+			while(pop(id, i))
+				(*mTask)(i);
+		}
+		while(steal(id));
+	}
+
+	bool ThreadPool::pop(int id, int& index)
+	{
+		uint64_t share = mShares[id];
+		while(true)
+		{
+			int begin = (int)(uint32_t)share;
+			int end = (int)(share >> 32);
+			if(begin >= end)
+				return false;
+			if(mShares[id].compare_exchange_weak(share, _share(begin + 1, end)))
+			{
+				index = begin;
+				return true;
+			}
+		}
+	}
+
+	bool ThreadPool::steal(int id)
+	{
+		while(true)
+		{
+			int victim = -1;
+			int most = 0;
+			uint64_t share = 0;
+			for(int i = 0; i < size(); i++)
+			{
+				uint64_t s = mShares[i];
+				int left = (int)(s >> 32) - (int)(uint32_t)s;
+				if(left > most)
+				{
+					victim = i;
+					most = left;
+					share = s;
+				}
+			}
+			if(victim < 0)
+				return false;
+			int begin = (int)(uint32_t)share;
+			int end = (int)(share >> 32);
+			int mid = begin + most / 2;
+			//the victim keeps the front, a failed exchange means it moved on in the meantime
+			if(mShares[victim].compare_exchange_strong(share, _share(begin, mid)))
+			{
+				mShares[id] = _share(mid, end);
+				return true;
+			}
+		}
+	}
+
+	ThreadPool& _pool()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+}
+
+int pp::threadCount()
+{
+	return _pool().size();
+}
+
+void pp::parallelFor(int count, const std::function<void(int)>& task)
+{
+	_pool().run(count, task, false);
+}
+
+void pp::parallelForStealing(int count, const std::function<void(int)>& task)
+{
+	_pool().run(count, task, true);
+}
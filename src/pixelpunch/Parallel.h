@@ -0,0 +1,23 @@
+#pragma once
+
+#include <functional>
+
+namespace pp 
+{
+	//number of threads parallelFor spreads its work over
+	int threadCount();
+
+	/*
+	Calls task(i) for every i in [0, count) on a shared thread pool and returns once all of them are done.
+	Indices are handed out in increasing order, so a task may wait for one with a lower index. Calls made
+	while the pool is busy (e.g. from inside a task) run serially on the calling thread.
+	*/
+	void parallelFor(int count, const std::function<void(int)>& task);
+
+	/*
+	Like parallelFor but for tasks that don't depend on each other and may take very different amounts of time.
+	Each thread starts on its own contiguous share of the indices, a thread that runs out of work steals
+	the back half of the largest share left. Indices are handed out in no particular order.
+	*/
+	void parallelForStealing(int count, const std::function<void(int)>& task);
+}
@@ -1,6 +1,10 @@
 #include "PixelPunch.h"
 #include "Kernel.h"
+#include "LineBuffer.h"
+#include "Parallel.h"
 #include <cassert>
+#include <algorithm>
+#include <vector>
 
 using namespace cinder;
 
@@ -12,23 +16,125 @@ void pp::genDest(Surface& source, int scaleFactor, Surface& result)
 	result = Surface(w, h, alpha);
 }
 
+//rows of the source each task of getColors collects the colors of
+const int COLOR_BAND = 64;
+//marks the unused slots of a ColorTable, packed colors never have the upper byte set
+const uint32_t NO_COLOR = 0xFFFFFFFF;
+
+/*
+Open addressing hash table of packed 0x00RRGGBB colors with how often each occurs and the first position
+(in column major order) it occurs at.
+*/
+struct ColorTable
+{
+	ColorTable() : size(0), bits(0)
+	{
+		resize(8);
+	}
+	//slot of color, or of the empty slot it goes into
+	int find(uint32_t color) const
+	{
+		uint32_t mask = (uint32_t)keys.size() - 1;
+		uint32_t slot = (color * 2654435761u) >> (32 - bits);
+		while(keys[slot] != NO_COLOR && keys[slot] != color)
+			slot = (slot + 1) & mask;
+		return slot;
+	}
+	int add(uint32_t color, int64_t position, int count)
+	{
+		if(2 * (size + 1) > (int)keys.size())
+			resize(bits + 1);
+		int slot = find(color);
+		if(keys[slot] == NO_COLOR)
+		{
+			keys[slot] = color;
+			counts[slot] = count;
+			first[slot] = position;
+			size++;
+		}
+		else
+		{
+			counts[slot] += count;
+			first[slot] = std::min(first[slot], position);
+		}
+		return slot;
+	}
+	void resize(int newBits)
+	{
+		std::vector<uint32_t> oldKeys(1 << newBits, NO_COLOR);
+		std::vector<int> oldCounts(1 << newBits, 0);
+		std::vector<int64_t> oldFirst(1 << newBits, 0);
+		oldKeys.swap(keys);
+		oldCounts.swap(counts);
+		oldFirst.swap(first);
+		bits = newBits;
+		for(size_t i = 0; i < oldKeys.size(); i++)
+			if(oldKeys[i] != NO_COLOR)
+			{
+				int slot = find(oldKeys[i]);
+				keys[slot] = oldKeys[i];
+				counts[slot] = oldCounts[i];
+				first[slot] = oldFirst[i];
+			}
+	}
+	std::vector<uint32_t> keys;
+	std::vector<int> counts;
+	std::vector<int64_t> first;
+	int size;
+	int bits;
+};
+
 void pp::getColors(cinder::Surface& source, Palette& result)
 {
-	result.clear();
-	Vec2i v(0,0);
+	std::vector<int> counts;
+	getColors(source, result, counts);
+}
+
+void pp::getColors(cinder::Surface& source, Palette& result, std::vector<int>& counts)
+{
 	int width = source.getWidth();
 	int height = source.getHeight();
-	for(v.x = 0; v.x < width; v.x++)
-		for(v.y = 0; v.y < height; v.y++)
+	int bands = (height + COLOR_BAND - 1) / COLOR_BAND;
+	std::vector<ColorTable> tables(bands);
+	parallelFor(bands, [&](int band)
+	{
+		ColorTable& table = tables[band];
+		std::vector<uint32_t> row(width);
+		for(int y = band * COLOR_BAND; y < std::min(height, (band + 1) * COLOR_BAND); y++)
 		{
-			Color8u pxl = source.getPixel(v);
-			bool found = false;
-			for(Palette::iterator it = result.begin(); it != result.end(); it++)
-				if(it->distanceSquared(pxl) == 0)//found
-					found = true;
-			if(!found)
-				result.push_back(pxl);
+			packRow(source, y, &row[0]);
+			//pixel art repeats colors a lot, runs of the same color only count up the slot found last
+			uint32_t last = NO_COLOR;
+			int slot = 0;
+			for(int x = 0; x < width; x++)
+				if(row[x] == last)
+					table.counts[slot]++;
+				else
+				{
+					last = row[x];
+					slot = table.add(last, (int64_t)x * height + y, 1);
+				}
 		}
+	});
+	ColorTable merged;
+	for(int band = 0; band < bands; band++)
+		for(size_t i = 0; i < tables[band].keys.size(); i++)
+			if(tables[band].keys[i] != NO_COLOR)
+				merged.add(tables[band].keys[i], tables[band].first[i], tables[band].counts[i]);
+	//in the order the colors are first met walking the source column by column
+	std::vector<std::pair<int64_t, int> > order;
+	for(size_t i = 0; i < merged.keys.size(); i++)
+		if(merged.keys[i] != NO_COLOR)
+			order.push_back(std::make_pair(merged.first[i], (int)i));
+	std::sort(order.begin(), order.end());
+	result.clear();
+	counts.clear();
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		uint32_t color = merged.keys[order[i].second];
+		result.push_back(Color8u(0xFF & (color >> 16), 0xFF & (color >> 8), 0xFF & color));
+		counts.push_back(merged.counts[order[i].second]);
+	}
 }
 
 Surface pp::compare(Surface& imageA, Surface& imageB)
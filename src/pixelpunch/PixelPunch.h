@@ -3,6 +3,11 @@
 #include "cinder/Cinder.h"
 #include "cinder/Surface.h"
 #include <list>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PP_SSE2
+#endif
 
 namespace pp 
 {
@@ -11,7 +16,10 @@ namespace pp
 	typedef std::list<cinder::Color8u> Palette;
 
 	void genDest(cinder::Surface& source, int scaleFactor, cinder::Surface& result);
+	//the distinct colors of source, in the order they are first met walking it column by column
 	void getColors(cinder::Surface& source, Palette& result);
+	//same, counts[i] is how many pixels have the i-th color
+	void getColors(cinder::Surface& source, Palette& result, std::vector<int>& counts);
 	cinder::Surface compare(cinder::Surface& imageA, cinder::Surface& imageB);
 	cinder::Surface choose(cinder::Surface& imageA, cinder::Surface& imageB, cinder::Surface& errorA, cinder::Surface& secondWeight, float threshold);
 }
\ No newline at end of file
@@ -1,150 +1,272 @@
 #include "PixelPunch.h"
+#include "EqualityPlanes.h"
+#include "IndexedImage.h"
 #include "Kernel.h"
+#include "LineBuffer.h"
+#include "Parallel.h"
 #include "PixelScale.h"
+#include "RuleTable.h"
+#include "ScaleSIMD.h"
 #include <cassert>
+#include <atomic>
+#include <memory>
+#include <thread>
 
 using namespace cinder;
 using namespace pp;
 
-void _repeat(Surface& source, Surface& dest, int scaleFactor)
+//P is uint32_t for packed pixels or uint8_t for palette indices (see IndexedImage)
+template<class P>
+struct Scaler
 {
-	Surface::ConstIter srcIt = source.getIter();
-	Surface::Iter destIt = dest.getIter();
-	while(srcIt.line())
+	//scales one row given its padded neighbours, writing factor rows of factor * width pixels
+	void (*scaleRow)(const P* above, const P* center, const P* below, int width, P** dest);
+	int factor;
+};
+
+struct Scale2xRule
+{
+	/*
+	A B C
+	D E F -> E0 E1
+	G H I    E2 E3
+
+	if (B != H && D != F)
+		E0 = D == B ? D : E;
+		E1 = B == F ? F : E;
+		E2 = D == H ? D : E;
+		E3 = H == F ? F : E;
+	*/
+	enum { A, B, C, D, E, F, G, H, I };
+	enum { B_is_H, D_is_F, D_is_B, B_is_F, D_is_H, H_is_F, Comparisons };
+	enum { Outputs = 4 };
+	static const int pairs[Comparisons][2];
+
+	static void sources(const bool* is, uint8_t* out)
 	{
-		//back to the start of source line
-		Surface::ConstIter copy = srcIt;
-		for(int i = 0; i < scaleFactor; i++)
-		{
-			destIt.line();
-			while(srcIt.pixel()) 
-			{
-				for(int j = 0; j < scaleFactor; j++)
-				{
-					destIt.pixel();
-					destIt.r() = srcIt.r(); 
-					destIt.g() = srcIt.g();
-					destIt.b() = srcIt.b();
-				}
-			}
-			//reset srcIt
-			srcIt = copy;
-		}
+		bool prereq = !is[B_is_H] && !is[D_is_F];
+		out[0] = prereq && is[D_is_B] ? D : E;
+		out[1] = prereq && is[B_is_F] ? F : E;
+		out[2] = prereq && is[D_is_H] ? D : E;
+		out[3] = prereq && is[H_is_F] ? F : E;
 	}
+};
+const int Scale2xRule::pairs[][2] = { {B, H}, {D, F}, {D, B}, {B, F}, {D, H}, {H, F} };
+
+struct Scale3xRule
+{
+	/*
+	A B C    E0 E1 E2
+	D E F -> E3 E4 E5
+	G H I    E6 E7 E8
+
+	if (B != H && D != F) {
+		E0 = D == B										? D : E;
+		E1 = (D == B && E != C) || (B == F && E != A)	? B : E;
+		E2 = B == F										? F : E;
+	
+		E3 = (D == B && E != G) || (D == H && E != A)	? D : E;
+		E4 = E;
+		E5 = (B == F && E != I) || (H == F && E != C)	? F : E;
+	
+		E6 = D == H										? D : E;
+		E7 = (D == H && E != I) || (H == F && E != G)	? H : E;
+		E8 = H == F										? F : E;
+	*/
+	enum { A, B, C, D, E, F, G, H, I };
+	enum { B_is_H, D_is_F, D_is_B, B_is_F, D_is_H, H_is_F, E_is_A, E_is_C, E_is_G, E_is_I, Comparisons };
+	enum { Outputs = 9 };
+	static const int pairs[Comparisons][2];
+
+	static void sources(const bool* is, uint8_t* out)
+	{
+		bool prereq = !is[B_is_H] && !is[D_is_F];
+		out[0] = prereq && is[D_is_B]													? D : E;
+		out[1] = prereq && ((is[D_is_B] && !is[E_is_C]) || (is[B_is_F] && !is[E_is_A]))	? B : E;
+		out[2] = prereq && is[B_is_F]													? F : E;
+
+		out[3] = prereq && ((is[D_is_B] && !is[E_is_G]) || (is[D_is_H] && !is[E_is_A]))	? D : E;
+		out[4] = E;
+		out[5] = prereq && ((is[B_is_F] && !is[E_is_I]) || (is[H_is_F] && !is[E_is_C]))	? F : E;
+
+		out[6] = prereq && is[D_is_H]													? D : E;
+		out[7] = prereq && ((is[D_is_H] && !is[E_is_I]) || (is[H_is_F] && !is[E_is_G]))	? H : E;
+		out[8] = prereq && is[H_is_F]													? F : E;
+	}
+};
+const int Scale3xRule::pairs[][2] = { {B, H}, {D, F}, {D, B}, {B, F}, {D, H}, {H, F}, {E, A}, {E, C}, {E, G}, {E, I} };
+
+struct Eagle2xRule
+{
+	/*
+	first:        |Then 
+	. . . --\ CC  |S T U  --\ 1 2
+	. C . --/ CC  |V C W  --/ 3 4
+	. . .         |X Y Z
+				  | IF V==S==T => 1=S
+				  | IF T==U==W => 2=U
+				  | IF V==X==Y => 3=X
+				  | IF W==Z==Y => 4=Z
+	*/
+	enum { S, T, U, V, C, W, X, Y, Z };
+	enum { V_is_S, T_is_S, T_is_U, W_is_U, V_is_X, Y_is_X, W_is_Z, Y_is_Z, Comparisons };
+	enum { Outputs = 4 };
+	static const int pairs[Comparisons][2];
+
+	static void sources(const bool* is, uint8_t* out)
+	{
+		out[0] = is[V_is_S] && is[T_is_S] ? S : C;
+		out[1] = is[T_is_U] && is[W_is_U] ? U : C;
+		out[2] = is[V_is_X] && is[Y_is_X] ? X : C;
+		out[3] = is[W_is_Z] && is[Y_is_Z] ? Z : C;
+	}
+};
+const int Eagle2xRule::pairs[][2] = { {V, S}, {T, S}, {T, U}, {W, U}, {V, X}, {Y, X}, {W, Z}, {Y, Z} };
+
+const RuleTable<Scale2xRule> SCALE2X_RULES;
+const RuleTable<Scale3xRule> SCALE3X_RULES;
+const RuleTable<Eagle2xRule> EAGLE2X_RULES;
+
+template<class P>
+void _repeatRow(const P* above, const P* center, const P* below, int width, P** dest)
+{
+	std::copy(center, center + width, dest[0]);
 }
 
-void _scale2x(Surface& source, Surface& dest)
+template<class P>
+void _scale2xRow(const P* above, const P* center, const P* below, int width, P** dest)
 {
-	Kernel kSrc(source, 3, 3, 1, 1);
-	Kernel kDst(dest, 2, 2);
-	uint32_t** src = kSrc.pixels;
-	uint32_t** dst = kDst.pixels;
+	//the vectorized rules handle the bulk of the row, the rest is done pixel by pixel
+	int done = scale2xRowSIMD(above, center, below, width, dest[0], dest[1]);
+	if(done == width)
+		return;
+
+	SlidingWindow<P> kSrc(above, center, below, width);
+	Kernel<2, 2, 0, 0, P> dst;
+	kSrc.begin(done);
 	do
 	{
-		/*
-		A B C
-		D E F -> E0 E1 -> 00 10
-		G H I    E2 E3    01 11
-
-		if (B != H && D != F)
-			E0 = D == B ? D : E;
-			E1 = B == F ? F : E;
-			E2 = D == H ? D : E;
-			E3 = H == F ? F : E;
-		*/
-		kSrc.read();
-		bool prereq = (src[1][0] != src[1][2]) && (src[0][1] != src[2][1]);
-		dst[0][0] = prereq && (src[0][1] == src[1][0]) ? src[0][1] : src[1][1];
-		dst[1][0] = prereq && (src[1][0] == src[2][1]) ? src[2][1] : src[1][1];
-		dst[0][1] = prereq && (src[0][1] == src[1][2]) ? src[0][1] : src[1][1];
-		dst[1][1] = prereq && (src[1][2] == src[2][1]) ? src[2][1] : src[1][1];
-			
+		SCALE2X_RULES.apply(kSrc.pixels, dst);
+		dst.store(dest, 2 * kSrc.x());
 	}
-	while(kDst.write(2));
+	while(kSrc.slide());
 }
 
-void _scale3x(Surface& source, Surface& dest)
+template<class P>
+void _scale3xRow(const P* above, const P* center, const P* below, int width, P** dest)
 {
-	Kernel kSrc(source, 3, 3, 1, 1);
-	Kernel kDst(dest, 3, 3, 0, 0);
-	uint32_t** src = kSrc.pixels;
-	uint32_t** dst = kDst.pixels;
+	//the vectorized rules handle the bulk of the row, the rest is done pixel by pixel
+	int done = scale3xRowSIMD(above, center, below, width, dest[0], dest[1], dest[2]);
+	if(done == width)
+		return;
+
+	SlidingWindow<P> kSrc(above, center, below, width);
+	Kernel<3, 3, 0, 0, P> dst;
+	kSrc.begin(done);
 	do
 	{
-	/*
-		A B C    E0 E1 E2     00 10 20
-		D E F -> E3 E4 E5 ->  01 11 21
-		G H I    E6 E7 E8     02 12 22
-
-		if (B != H && D != F) {
-			E0 = D == B										? D : E;
-			E1 = (D == B && E != C) || (B == F && E != A)	? B : E;
-			E2 = B == F										? F : E;
-				
-			E3 = (D == B && E != G) || (D == H && E != A)	? D : E;
-			E4 = E;
-			E5 = (B == F && E != I) || (H == F && E != C)	? F : E;
-				
-			E6 = D == H										? D : E;
-			E7 = (D == H && E != I) || (H == F && E != G)	? H : E;
-			E8 = H == F										? F : E;
-	*/
-		kSrc.read();
-		bool prereq = (src[1][0] != src[1][2]) && (src[0][1] != src[2][1]);
-		bool D_is_B = (src[0][1] == src[1][0]);
-		bool B_is_F = (src[1][0] == src[2][1]);
-		bool D_is_H = (src[0][1] == src[1][2]);
-		bool H_is_F = (src[1][2] == src[2][1]);
-		bool E_not_C = (src[1][1] != src[2][0]);
-		bool E_not_G = (src[1][1] != src[0][2]);
-		bool E_not_I = (src[1][1] != src[2][2]);
-		bool E_not_A = (src[1][1] != src[0][0]);
-			
-		dst[0][0] = prereq && D_is_B										? src[0][1] : src[1][1];
-		dst[1][0] = prereq && ((D_is_B && E_not_C) || (B_is_F && E_not_A))	? src[1][0] : src[1][1];
-		dst[2][0] = prereq && B_is_F										? src[2][1] : src[1][1];
-			
-		dst[0][1] = prereq && ((D_is_B && E_not_G) || (D_is_H && E_not_A))	? src[0][1] : src[1][1];
-		dst[1][1] = src[1][1];
-		dst[2][1] = prereq && ((B_is_F && E_not_I) || (H_is_F && E_not_C))	? src[2][1] : src[1][1];
-			
-		dst[0][2] = prereq && D_is_H										? src[0][1] : src[1][1];
-		dst[1][2] = prereq && ((D_is_H && E_not_I) || (H_is_F && E_not_G))	? src[1][2] : src[1][1];
-		dst[2][2] = prereq && H_is_F										? src[2][1] : src[1][1];
+		SCALE3X_RULES.apply(kSrc.pixels, dst);
+		dst.store(dest, 3 * kSrc.x());
 	}
-	while(kDst.write(3));
+	while(kSrc.slide());
 }
 
-void _eagle2x(Surface& source, Surface& dest)
+template<class P>
+void _eagle2xRow(const P* above, const P* center, const P* below, int width, P** dest)
 {
-	Kernel kSrc(source, 3, 3, 1, 1);
-	Kernel kDst(dest, 2, 2);
-	uint32_t** src = kSrc.pixels;
-	uint32_t** dst = kDst.pixels;
+	SlidingWindow<P> kSrc(above, center, below, width);
+	Kernel<2, 2, 0, 0, P> dst;
+	kSrc.begin();
 	do
 	{
-		/*
-		first:        |Then 
-		. . . --\ CC  |00 10 20		S T U  --\ 1 2
-		. C . --/ CC  |01 11 21		V C W  --/ 3 4
-		. . .         |02 12 22		X Y Z
-					  | IF V==S==T => 1=S
-					  | IF T==U==W => 2=U
-					  | IF V==X==Y => 3=X
-					  | IF W==Z==Y => 4=Z
-		*/
-		kSrc.read();
-		dst[0][0] = (src[0][1] == src[0][0] && src[1][0] == src[0][0]) ? src[0][0] : src[1][1];
-		dst[1][0] = (src[1][0] == src[2][0] && src[2][1] == src[2][0]) ? src[2][0] : src[1][1];
-		dst[0][1] = (src[0][1] == src[0][2] && src[1][2] == src[0][2]) ? src[0][2] : src[1][1];
-		dst[1][1] = (src[2][1] == src[2][2] && src[1][2] == src[2][2]) ? src[2][2] : src[1][1];
-			
+		EAGLE2X_RULES.apply(kSrc.pixels, dst);
+		dst.store(dest, 2 * kSrc.x());
 	}
-	while(kDst.write(2));
+	while(kSrc.slide());
+}
+
+//the scalers for one kind of pixel
+template<class P>
+struct Scalers
+{
+	static const Scaler<P> REPEAT;
+	static const Scaler<P> SCALE2X;
+	static const Scaler<P> SCALE3X;
+	static const Scaler<P> EAGLE2X;
+};
+template<class P> const Scaler<P> Scalers<P>::REPEAT = { _repeatRow<P>, 1 };
+template<class P> const Scaler<P> Scalers<P>::SCALE2X = { _scale2xRow<P>, 2 };
+template<class P> const Scaler<P> Scalers<P>::SCALE3X = { _scale3xRow<P>, 3 };
+template<class P> const Scaler<P> Scalers<P>::EAGLE2X = { _eagle2xRow<P>, 2 };
+
+template<class P>
+void _scaleSpan(const Scaler<P>& scaler, const P* above, const P* center, const P* below, int from, int to, P** dest)
+{
+	if(from == to)
+		return;
+
+	P* spanDest[4];
+	for(int i = 0; i < scaler.factor; i++)
+		spanDest[i] = dest[i] + scaler.factor * from;
+	scaler.scaleRow(above + from, center + from, below + from, to - from, spanDest);
 }
 
+template<class P>
+void _scaleRow(const Scaler<P>& scaler, const P* above, const P* center, const P* below, int width, P** dest)
+{
+	/*
+	Where a pixel and its whole neighbourhood have the same colour every scaler just replicates it. Runs of
+	such pixels are filled directly and only the spans between them go through the rules. Short runs aren't
+	worth splitting the row for.
+	*/
+	const int minRun = 8;
+	int f = scaler.factor;
+	//without scaling there is nothing to replicate
+	if(f == 1)
+	{
+		scaler.scaleRow(above, center, below, width, dest);
+		return;
+	}
 
-void _fillFissure(Surface& surf)
+	//columns are looked at in blocks of 64 starting one left of the pixels they decide
+	const P* rows[3] = { above, center, below };
+	int from = 0;
+	for(int x = 0; x < width; x += 62)
+	{
+		int count = std::min(62, width - x);
+		EqualityPlanes eq(rows, x - 1, 1, count + 2);
+		uint64_t uniform = eq(0,0, 0,-1) & eq(0,0, 0,1);
+		//the last column has no right neighbour within the padding, and none is needed
+		EqualityPlanes pairs(rows, x - 1, 1, count + 1);
+		uint64_t right = pairs(0,0, 1,0);
+		//bit i + 1 of a column mask is pixel x + i, its neighbours are the bits next to it
+		uint64_t flat = (uniform << 1) & uniform & (uniform >> 1) & (right << 1) & right;
+		flat = (flat >> 1) & ((uint64_t(1) << count) - 1);
+		for(int i = 0; i < count && (flat >> i) != 0; )
+		{
+			if(!((flat >> i) & 1))
+			{
+				i++;
+				continue;
+			}
+			int run = 1;
+			while(i + run < count && ((flat >> (i + run)) & 1))
+				run++;
+			if(run >= minRun)
+			{
+				_scaleSpan(scaler, above, center, below, from, x + i, dest);
+				for(int j = 0; j < f; j++)
+					fillRow(dest[j] + f * (x + i), f * run, center[x + i]);
+				from = x + i + run;
+			}
+			i += run;
+		}
+	}
+	_scaleSpan(scaler, above, center, below, from, width, dest);
+}
+
+template<class P>
+struct FillFissureFilter
 {
 	/* 
 	The artefact we want to remove consists of a cluster of 3 pixels sourrounded by pixels of the same other color.
@@ -154,36 +276,47 @@ void _fillFissure(Surface& surf)
 		a a B	B a a	B a a	a a B
 		B B .	. B B	B a B	B a B
 	*/
+	typedef Kernel<3, 3, 1, 1, P> Window;
 
-	Kernel k(surf, 3, 3, 1, 1);
-	uint32_t** p = k.pixels;
-	do
+	bool operator()(Window& p) const
 	{
-		k.read(0);
-		uint32_t cA = p[1][1];
+		bool changed = false;
+		P cA = p(1, 1);
 		for(int i = -1; i < 2; i += 2)
 			for(int j = -1; j < 2; j += 2)
 			{
-				uint32_t cB = p[1+j][1+i];
+				P cB = p(1+j, 1+i);
 				if(cA == cB)
 					continue;
 				//crease exists?
-				if((p[1+j][1] != cA) || (p[1][1+i] != cA))
+				if((p(1+j, 1) != cA) || (p(1, 1+i) != cA))
 					continue;
 				//sourrounded? (edge)
-				if((p[1-j][1] != cB) || (p[1][1-i] != cB))
+				if((p(1-j, 1) != cB) || (p(1, 1-i) != cB))
 					continue;
 				//sourrounded? (corners)
-				if((p[1-j][1+i] != cB) || (p[1+j][1-i] != cB))
+				if((p(1-j, 1+i) != cB) || (p(1+j, 1-i) != cB))
 					continue;
 
-				p[1][1] = p[1+j][1] = p[1][1+i] = cB;
+				p(1, 1) = p(1+j, 1) = p(1, 1+i) = cB;
+				changed = true;
 			}
+		return changed;
 	}
-	while(k.write(1));
-}
 
-void _fillSingle(Surface& surf)
+	uint64_t candidates(EqualityPlanes& eq) const
+	{
+		uint64_t result = 0;
+		for(int i = -1; i < 2; i += 2)
+			for(int j = -1; j < 2; j += 2)
+				result |= ~eq(0,0, j,i) & eq(j,0, 0,0) & eq(0,i, 0,0) 
+					& eq(-j,0, j,i) & eq(0,-i, j,i) & eq(-j,i, j,i) & eq(j,-i, j,i);
+		return result;
+	}
+};
+
+template<class P>
+struct FillSingleFilter
 {
 	/* 
 	The artefact we want to remove consists of a single pixel flanked by pixels of the same other color.
@@ -193,20 +326,28 @@ void _fillSingle(Surface& surf)
 		x A x
 		. x .
 	*/
-	Kernel k(surf, 3, 3, 1, 1);
-	uint32_t** p = k.pixels;
-	do
+	typedef Kernel<3, 3, 1, 1, P> Window;
+
+	bool operator()(Window& p) const
+	{
+		P cA = p(1, 1);
+		P ref = p(0, 1);
+		if(cA != ref && ref == p(1, 0) && ref == p(2, 1) && ref == p(1, 2))
+		{
+			p(1, 1) = ref;
+			return true;
+		}
+		return false;
+	}
+
+	uint64_t candidates(EqualityPlanes& eq) const
 	{
-		k.read(0);
-		uint32_t cA = p[1][1];
-		uint32_t ref = p[0][1];
-		if(cA != ref && ref == p[1][0] && ref == p[2][1] && ref == p[1][2])
-			p[1][1] = ref;
+		return ~eq(0,0, -1,0) & eq(-1,0, 0,-1) & eq(-1,0, 1,0) & eq(-1,0, 0,1);
 	}
-	while(k.write(1));
-}
+};
 
-void _buffDouble(Surface& surf)
+template<class P>
+struct BuffDoubleFilter
 {
 	/* 
 	We want to buff two individual pixels of the same color touching corners.
@@ -215,23 +356,37 @@ void _buffDouble(Surface& surf)
 		. A	x .		. x A .
 		x . . .		. . . x
 	*/
-	Kernel k(surf, 4, 4, 1, 1);
-	uint32_t** p = k.pixels;
-	do
+	typedef Kernel<4, 4, 1, 1, P> Window;
+
+	bool operator()(Window& p) const
 	{
-		k.read(0);
-		uint32_t ref = p[2][1];
-		if(ref == p[1][2] && ref != p[0][3] && ref != p[3][0] && ref != p[1][1] && ref != p[2][2])
-			p[1][1] = p[2][2] = ref;
-
-		ref = p[1][1];
-		if(ref == p[2][2] && ref != p[0][0] && ref != p[3][3] && ref != p[2][1] && ref != p[1][2])
-			p[2][1] = p[1][2] = ref;
+		bool changed = false;
+		P ref = p(2, 1);
+		if(ref == p(1, 2) && ref != p(0, 3) && ref != p(3, 0) && ref != p(1, 1) && ref != p(2, 2))
+		{
+			p(1, 1) = p(2, 2) = ref;
+			changed = true;
+		}
+
+		ref = p(1, 1);
+		if(ref == p(2, 2) && ref != p(0, 0) && ref != p(3, 3) && ref != p(2, 1) && ref != p(1, 2))
+		{
+			p(2, 1) = p(1, 2) = ref;
+			changed = true;
+		}
+		return changed;
 	}
-	while(k.write(1));
-}
 
-void _buffTripleStrict(Surface& surf)
+	uint64_t candidates(EqualityPlanes& eq) const
+	{
+		uint64_t first = eq(1,0, 0,1) & ~eq(1,0, -1,2) & ~eq(1,0, 2,-1) & ~eq(1,0, 0,0) & ~eq(1,0, 1,1);
+		uint64_t second = eq(0,0, 1,1) & ~eq(0,0, -1,-1) & ~eq(0,0, 2,2) & ~eq(0,0, 1,0) & ~eq(0,0, 0,1);
+		return first | second;
+	}
+};
+
+template<class P>
+struct BuffTripleStrictFilter
 {
 	/* 
 	We want to connect individual pixels to larger clusters
@@ -240,27 +395,41 @@ void _buffTripleStrict(Surface& surf)
 		x A x	x A x 
 		. x A	A x .
 	*/
+	typedef Kernel<3, 3, 1, 1, P> Window;
 
-	Kernel k(surf, 3, 3, 1, 1);
-	uint32_t** p = k.pixels;
-	do
+	bool operator()(Window& p) const
 	{
-		k.read(0);
-		uint32_t ref = p[0][0];
-		if( ref == p[1][1] && ref == p[2][2] && //line exists
-			ref != p[0][1] && ref != p[1][2] && ref != p[1][0] && ref != p[2][1]) //neighbours differ
-				p[0][1] = p[1][2] = p[1][0] = p[2][1] = ref;
-
-		ref = p[2][0];
-		if( ref == p[1][1] && ref == p[0][2] && //line exists
-			ref != p[0][1] && ref != p[1][2] && ref != p[1][0] && ref != p[2][1]) //neighbours differ
-				p[0][1] = p[1][2] = p[1][0] = p[2][1] = ref;
+		bool changed = false;
+		P ref = p(0, 0);
+		if( ref == p(1, 1) && ref == p(2, 2) && //line exists
+			ref != p(0, 1) && ref != p(1, 2) && ref != p(1, 0) && ref != p(2, 1)) //neighbours differ
+		{
+			p(0, 1) = p(1, 2) = p(1, 0) = p(2, 1) = ref;
+			changed = true;
+		}
+
+		ref = p(2, 0);
+		if( ref == p(1, 1) && ref == p(0, 2) && //line exists
+			ref != p(0, 1) && ref != p(1, 2) && ref != p(1, 0) && ref != p(2, 1)) //neighbours differ
+		{
+			p(0, 1) = p(1, 2) = p(1, 0) = p(2, 1) = ref;
+			changed = true;
+		}
+		return changed;
 	}
-	while(k.write(1));
-}
 
+	uint64_t candidates(EqualityPlanes& eq) const
+	{
+		uint64_t first = eq(-1,-1, 0,0) & eq(-1,-1, 1,1) 
+			& ~eq(-1,-1, -1,0) & ~eq(-1,-1, 0,1) & ~eq(-1,-1, 0,-1) & ~eq(-1,-1, 1,0);
+		uint64_t second = eq(1,-1, 0,0) & eq(1,-1, -1,1) 
+			& ~eq(1,-1, -1,0) & ~eq(1,-1, 0,1) & ~eq(1,-1, 0,-1) & ~eq(1,-1, 1,0);
+		return first | second;
+	}
+};
 
-void _buffTripleLoose(Surface& surf)
+template<class P>
+struct BuffTripleLooseFilter
 {
 	/* 
 	We want to connect individual pixels to larger clusters. X and Y will be judged
@@ -270,90 +439,330 @@ void _buffTripleLoose(Surface& surf)
 		x A y	x A y 
 		. y A	A x .
 	*/
+	typedef Kernel<3, 3, 1, 1, P> Window;
 
-	Kernel k(surf, 3, 3, 1, 1);
-	uint32_t** p = k.pixels;
-	do
+	bool operator()(Window& p) const
 	{
-		k.read(0);
-		uint32_t ref = p[0][0];
-		if( ref == p[1][1] && ref == p[2][2]) //line exists
+		bool changed = false;
+		P ref = p(0, 0);
+		if( ref == p(1, 1) && ref == p(2, 2)) //line exists
 		{
-			if(ref != p[0][1] && ref != p[1][0]) 
-				p[0][1] = p[1][0] = ref;
-			if(ref != p[1][2] && ref != p[2][1]) //neighbours differ
-				p[1][2] = p[2][1] = ref;
+			if(ref != p(0, 1) && ref != p(1, 0)) 
+			{
+				p(0, 1) = p(1, 0) = ref;
+				changed = true;
+			}
+			if(ref != p(1, 2) && ref != p(2, 1)) //neighbours differ
+			{
+				p(1, 2) = p(2, 1) = ref;
+				changed = true;
+			}
 		}
-		ref = p[2][0];
-		if( ref == p[1][1] && ref == p[0][2]) //line exists
+		ref = p(2, 0);
+		if( ref == p(1, 1) && ref == p(0, 2)) //line exists
 		{
-			if(ref != p[0][1] && ref != p[1][2] ) //neighbours differ
-				p[0][1] = p[1][2] = ref;
-			if(ref != p[1][0] && ref != p[2][1]) //neighbours differ
-				p[1][0] = p[2][1] = ref;
+			if(ref != p(0, 1) && ref != p(1, 2) ) //neighbours differ
+			{
+				p(0, 1) = p(1, 2) = ref;
+				changed = true;
+			}
+			if(ref != p(1, 0) && ref != p(2, 1)) //neighbours differ
+			{
+				p(1, 0) = p(2, 1) = ref;
+				changed = true;
+			}
 		}
+		return changed;
 	}
-	while(k.write(1));
+
+	uint64_t candidates(EqualityPlanes& eq) const
+	{
+		uint64_t first = eq(-1,-1, 0,0) & eq(-1,-1, 1,1) 
+			& ((~eq(-1,-1, -1,0) & ~eq(-1,-1, 0,-1)) | (~eq(-1,-1, 0,1) & ~eq(-1,-1, 1,0)));
+		uint64_t second = eq(1,-1, 0,0) & eq(1,-1, -1,1) 
+			& ((~eq(1,-1, -1,0) & ~eq(1,-1, 0,1)) | (~eq(1,-1, 0,-1) & ~eq(1,-1, 1,0)));
+		return first | second;
+	}
+};
+
+template<class Filter>
+inline bool _filterPixel(const Filter& filter, typename Filter::Window::Pixel** rows, int width, int height, int cx, int cy)
+{
+	typename Filter::Window p;
+	p.read(rows, width, height, cx, cy);
+	if(!filter(p))
+		return false;
+	p.write(rows, width, height, cx, cy);
+	return true;
 }
 
-void genDest(Surface& source, int scaleFactor, Surface& result)
+template<class Filter>
+uint64_t _candidates(const Filter& filter, typename Filter::Window::Pixel** rows, int width, int height, int from, int to, int y)
 {
-	int w = scaleFactor * source.getWidth();
-	int h = scaleFactor * source.getHeight();
-	bool alpha = source.hasAlpha();
-	result = Surface(w, h, alpha);
+	/*
+	The pixels in [from, to) of row y the filter might change. Where the window is clamped at the border
+	the equality planes don't apply and the pixel is always a candidate.
+	*/
+	typedef typename Filter::Window Window;
+	uint64_t all = (to - from == 64) ? ~uint64_t(0) : (uint64_t(1) << (to - from)) - 1;
+	if(y < Window::CenterY || y + Window::Height - Window::CenterY > height)
+		return all;
+
+	int left = std::max(from, (int)Window::CenterX);
+	int right = std::min(to, width - Window::Width + Window::CenterX + 1);
+	if(left >= right)
+		return all;
+
+	EqualityPlanes planes(rows, left, y, right - left);
+	uint64_t inner = filter.candidates(planes) & planes.all();
+	uint64_t border = all & ~(planes.all() << (left - from));
+	return (inner << (left - from)) | border;
 }
 
-Surface pp::scale(Surface& source, ScaleMethod method)
+template<class Filter>
+void _filterRows(typename Filter::Window::Pixel** rows, int width, int height, int fromRow, int toRow)
+{
+	/*
+	The filters modify the image in place, so every step sees the changes made by the steps before it in 
+	raster order. To get exactly that result in parallel the rows are processed as a wavefront: a row may 
+	only advance to x while the row above has finished everything up to x + Width, so neighbouring rows 
+	never touch the same pixels at the same time. Rows above fromRow are expected to be done already.
+
+	Most pixels don't match any rule, so each chunk of 64 pixels first evaluates the rules on equality 
+	bitplanes and only runs the filter on the candidates. Once the filter changed something the following
+	pixels whose window overlaps the change are no longer covered by the planes and are run, too.
+	*/
+	typedef typename Filter::Window Window;
+	const int chunk = 64;
+	Filter filter;
+	int count = toRow - fromRow;
+	std::unique_ptr<std::atomic<int>[]> progress(new std::atomic<int>[count]);
+	for(int i = 0; i < count; i++)
+		progress[i] = 0;
+
+	parallelFor(count, [&](int i)
+	{
+		int y = fromRow + i;
+		for(int from = 0; from < width; from += chunk)
+		{
+			int to = std::min(from + chunk, width);
+			int needed = std::min(to - 1 + Window::Width, width);
+			while(i > 0 && progress[i-1] < needed)
+				std::this_thread::yield();
+			uint64_t candidates = _candidates(filter, rows, width, height, from, to, y);
+			int dirty = from;
+			for(int x = from; x < to; x++)
+				if(x < dirty || (candidates >> (x - from)) & 1)
+					if(_filterPixel(filter, rows, width, height, x, y))
+						dirty = x + Window::Width;
+			progress[i] = to;
+		}
+	});
+}
+
+template<class P>
+struct FilterPass
+{
+	void (*filterRows)(P** rows, int width, int height, int fromRow, int toRow);
+	//rows a step reads and writes above and below the row it is centered on
+	int rowsAbove;
+	int rowsBelow;
+};
+
+template<class Filter>
+FilterPass<typename Filter::Window::Pixel> _pass()
 {
+	FilterPass<typename Filter::Window::Pixel> pass = { _filterRows<Filter>, Filter::Window::CenterY, Filter::Window::Height - 1 - Filter::Window::CenterY };
+	return pass;
+}
+
+//where the scalers get their pixels from, packed from a surface
+struct PackedSource
+{
+	typedef uint32_t Pixel;
+	typedef LineBuffer Lines;
+	PackedSource(Surface& surface) : image(surface) {}
+	int width() const { return image.getWidth(); }
+	int height() const { return image.getHeight(); }
+	void unpack(const uint32_t* row, Surface& dest, int y) const { unpackRow(row, dest, y); }
+	Surface& image;
+};
+
+//or indices of an IndexedImage
+struct IndexedSource
+{
+	typedef uint8_t Pixel;
+	typedef IndexedLines Lines;
+	IndexedSource(const IndexedImage& indexed) : image(indexed) {}
+	int width() const { return image.width(); }
+	int height() const { return image.height(); }
+	void unpack(const uint8_t* row, Surface& dest, int y) const { image.unpackRow(row, dest, y); }
+	const IndexedImage& image;
+};
+
+template<class Source>
+void _scaleRows(const Scaler<typename Source::Pixel>& scaler, const Source& source, Surface& dest, int fromRow, int toRow)
+{
+	typedef typename Source::Pixel P;
+	int f = scaler.factor;
+	typename Source::Lines lines(source.image, 1, 1);
+	std::vector<P> out(f * dest.getWidth());
+	std::vector<P*> rows(f);
+	for(int i = 0; i < f; i++)
+		rows[i] = &out[i * dest.getWidth()];
+	for(bool valid = lines.seek(fromRow); valid && lines.y() < toRow; valid = lines.next())
+	{
+		_scaleRow(scaler, lines.row(-1), lines.row(0), lines.row(1), lines.width(), &rows[0]);
+		for(int i = 0; i < f; i++)
+			source.unpack(rows[i], dest, f * lines.y() + i);
+	}
+}
+
+template<class Source>
+void _inBands(const Scaler<typename Source::Pixel>& scaler, const Source& source, Surface& dest)
+{
+	//each band loads its own halo rows from the shared source and writes a disjoint range of dest rows
+	int height = source.height();
+	int bands = std::min(height, 4 * threadCount());
+	parallelFor(bands, [&](int i)
+	{
+		_scaleRows(scaler, source, dest, i * height / bands, (i + 1) * height / bands);
+	});
+}
+
+template<class Source>
+void _pipeline(const Source& source, const Scaler<typename Source::Pixel>& first, const FilterPass<typename Source::Pixel>* passes, int passCount, 
+	const Scaler<typename Source::Pixel>& second, Surface& dest)
+{
+	typedef typename Source::Pixel P;
+	/*
+	Scales the source by first and then by second without ever storing the intermediate image: it is
+	produced a block of rows at a time into a ring, the filter passes run on it in order as far as the rows
+	they depend on are final and the second scaler consumes whatever rows no pass is going to touch again.
+	With REPEAT as the second scaler the filtered rows are just written out while they are still in cache.
+	*/
+	int width = first.factor * source.width();
+	int height = first.factor * source.height();
+	int blockRows = std::max(16, 4 * threadCount());
+	int lag = 2;
+	for(int i = 0; i < passCount; i++)
+		lag += passes[i].rowsAbove + passes[i].rowsBelow;
+	RowRing<P> ring(width, height, first.factor * blockRows + lag + 1);
+	P** rows = ring.rows();
+
+	std::vector<int> filtered(passCount, 0);
+	int consumed = 0;
+	for(int produced = 0; produced < height; )
+	{
+		//scale the next block of source rows into the ring
+		int fromRow = produced / first.factor;
+		int toRow = std::min(fromRow + blockRows, source.height());
+		int bands = std::min(toRow - fromRow, 4 * threadCount());
+		parallelFor(bands, [&](int i)
+		{
+			typename Source::Lines lines(source.image, 1, 1);
+			int bandTo = fromRow + (i + 1) * (toRow - fromRow) / bands;
+			for(bool valid = lines.seek(fromRow + i * (toRow - fromRow) / bands); valid && lines.y() < bandTo; valid = lines.next())
+				_scaleRow(first, lines.row(-1), lines.row(0), lines.row(1), lines.width(), rows + first.factor * lines.y());
+		});
+		produced = first.factor * toRow;
+
+		//a pass may filter a row once all the rows it reaches down to are final in the pass before
+		int ready = produced;
+		for(int i = 0; i < passCount; i++)
+		{
+			int to = (ready == height) ? height : std::max(filtered[i], ready - passes[i].rowsBelow);
+			passes[i].filterRows(rows, width, height, filtered[i], to);
+			filtered[i] = to;
+			ready = (to == height) ? height : std::max(0, to - passes[i].rowsAbove);
+		}
+
+		//the second scaler needs the row below, too
+		int to = (ready == height) ? height : std::max(consumed, ready - 1);
+		for(int y = consumed; y < ready; y++)
+			ring.pad(y);
+		int count = to - consumed;
+		bands = std::min(count, 4 * threadCount());
+		parallelFor(bands, [&](int i)
+		{
+			int f = second.factor;
+			std::vector<P> out(f * dest.getWidth());
+			std::vector<P*> outRows(f);
+			for(int j = 0; j < f; j++)
+				outRows[j] = &out[j * dest.getWidth()];
+			int bandTo = consumed + (i + 1) * count / bands;
+			for(int y = consumed + i * count / bands; y < bandTo; y++)
+			{
+				_scaleRow(second, rows[std::max(y - 1, 0)], rows[y], rows[std::min(y + 1, height - 1)], width, &outRows[0]);
+				for(int j = 0; j < f; j++)
+					source.unpack(outRows[j], dest, f * y + j);
+			}
+		});
+		consumed = to;
+	}
+}
+
+template<class Source>
+Surface _scale(Surface& surface, const Source& source, ScaleMethod method)
+{
+	typedef typename Source::Pixel P;
+	typedef Scalers<P> S;
 	Surface result;
-	Surface temp;
+	FilterPass<P> passes[2];
 	//migrate data
 	switch(method)
 	{
 	case SM_NONE:
-		genDest(source, 1, result);
-		_repeat(source, result, 1);
+		genDest(surface, 1, result);
+		_inBands(S::REPEAT, source, result);
 		break;
 	case SM_SCALE2x:
-		genDest(source, 2, result);
-		_scale2x(source, result);
+		genDest(surface, 2, result);
+		_inBands(S::SCALE2X, source, result);
 		break;
 	case SM_SCALE3x:
-		genDest(source, 3, result);
-		_scale3x(source, result);
+		genDest(surface, 3, result);
+		_inBands(S::SCALE3X, source, result);
 		break;
 	case SM_SCALE4x:
-		genDest(source, 2, temp);
-		_scale2x(source, temp);
-		genDest(temp, 2, result);
-		_scale2x(temp, result);
+		genDest(surface, 4, result);
+		_pipeline(source, S::SCALE2X, NULL, 0, S::SCALE2X, result);
 		break;
 	case SM_EAGLE2x:
-		genDest(source, 2, result);
-		_eagle2x(source, result);
+		genDest(surface, 2, result);
+		_inBands(S::EAGLE2X, source, result);
 		break;
 	case SM_SCALE2x_HQ:
-		genDest(source, 2, result);
-		_scale2x(source, result);
-		_fillSingle(result);
-		_buffDouble(result);
+		genDest(surface, 2, result);
+		passes[0] = _pass<FillSingleFilter<P> >();
+		passes[1] = _pass<BuffDoubleFilter<P> >();
+		_pipeline(source, S::SCALE2X, passes, 2, S::REPEAT, result);
 		break;
 	case SM_SCALE3x_HQ:
-		genDest(source, 3, result);
-		_scale3x(source, result);
-		_fillFissure(result);
-		_buffTripleStrict(result);
+		genDest(surface, 3, result);
+		passes[0] = _pass<FillFissureFilter<P> >();
+		passes[1] = _pass<BuffTripleStrictFilter<P> >();
+		_pipeline(source, S::SCALE3X, passes, 2, S::REPEAT, result);
 		break;
 	case SM_SCALE4x_HQ:
-		genDest(source, 2, temp);
-		_scale2x(source, temp);
-		_fillSingle(temp);
-		_buffDouble(temp);
-		genDest(temp, 2, result);
-		_eagle2x(temp, result);
-	break;
-
+		genDest(surface, 4, result);
+		passes[0] = _pass<FillSingleFilter<P> >();
+		passes[1] = _pass<BuffDoubleFilter<P> >();
+		_pipeline(source, S::SCALE2X, passes, 2, S::EAGLE2X, result);
+		break;
 	}
 	return result;
 }
+
+Surface pp::scale(Surface& source, ScaleMethod method)
+{
+	/*
+	Pixel art rarely has more than 256 colors, the cleanup filters then work on palette indices instead.
+	That makes up for converting to and from them, the plain scalers are bound by writing the result anyway.
+	*/
+	bool filtered = method == SM_SCALE2x_HQ || method == SM_SCALE3x_HQ || method == SM_SCALE4x_HQ;
+	IndexedImage indexed;
+	if(filtered && indexed.assign(source))
+		return _scale(source, IndexedSource(indexed), method);
+	return _scale(source, PackedSource(source), method);
+}
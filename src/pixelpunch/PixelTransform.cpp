@@ -1,12 +1,33 @@
 #include "PixelPunch.h"
 #include "PixelTransform.h"
-#include "Kernel.h"
+#include "Parallel.h"
 #include "cinder/Matrix.h"
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#ifdef PP_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace cinder;
 using namespace pp;
 
+//edge length of the square blocks the target is rendered in
+const int TILE_SIZE = 64;
+//cells of a mesh that don't get any smaller (see _drawMesh)
+const int MIN_CELL_SIZE = 4;
+//how far off whole numbers the mapping may be to be drawn lossless (see _drawLossless)
+const double LOSSLESS_EPSILON = 1e-3;
+//pixels per cache line, transposed rows are copied in square blocks of that size
+const int LOSSLESS_BLOCK = 16;
+//blank pixels between the frames of an atlas
+const int ATLAS_PADDING = 1;
+//sub-pixel positions the bicubic weights are precomputed for, per axis
+const int BICUBIC_PHASES = 256;
+//pixels repeated around the padded copy of the source the bicubic samplers read from
+const int BICUBIC_BORDER = 2;
 
 TransformMapping::TransformMapping(Vec2f* pts)
 {
@@ -38,6 +59,19 @@ TransformMapping::TransformMapping(const Rectf& rect)
 	localQuad[3] = bounds.getLowerLeft() - topLeft;
 }
 
+TransformMapping::TransformMapping(const Rectf& rect, float angle)
+{
+	Vec2f pts[4] = { rect.getUpperLeft(), rect.getUpperRight(), rect.getLowerRight(), rect.getLowerLeft() };
+	Vec2f center = rect.getCenter();
+	for(int i = 0; i < 4; i++)
+	{
+		pts[i] -= center;
+		pts[i].rotate(angle);
+		pts[i] += center;
+	}
+	*this = TransformMapping(pts);
+}
+
 Matrix33f _mapUnitSquareToQuad(ci::Vec2f* quad)
 {
 	Matrix33f result;
@@ -79,256 +113,1325 @@ Matrix33f _mapUnitSquareToQuad(ci::Vec2f* quad)
 
 }
 
+//writes samples to the pixels of a surface row the way Surface::setPixel would
+struct PixelWriter
+{
+	PixelWriter(Surface& dest)
+	:	inc(dest.getPixelInc()),
+		r(dest.getRedOffset()),
+		g(dest.getGreenOffset()),
+		b(dest.getBlueOffset()),
+		a(dest.getAlphaOffset()),
+		alpha(dest.hasAlpha())
+	{
+	}
+
+	void set(uint8_t* pixel, const ColorA8u& c) const
+	{
+		pixel[r] = c.r;
+		pixel[g] = c.g;
+		pixel[b] = c.b;
+		if(alpha)
+			pixel[a] = c.a;
+	}
+
+	//like setting a blank Color8u, alpha is left untouched
+	void clear(uint8_t* pixel, int count) const
+	{
+		if(inc == 3)
+			memset(pixel, 0, 3 * count);
+		else
+			for(int i = 0; i < count; i++, pixel += inc)
+				pixel[r] = pixel[g] = pixel[b] = 0;
+	}
+
+	int inc;
+	int r, g, b, a;
+	bool alpha;
+};
+
+//copies pixels from a surface into one written by a PixelWriter, like getPixel followed by set
+struct PixelCopier
+{
+	PixelCopier(const Surface& src, const PixelWriter& writer)
+	:	inc(writer.inc),
+		r(writer.r),
+		g(writer.g),
+		b(writer.b),
+		a(writer.a),
+		alpha(writer.alpha),
+		srcR(src.getRedOffset()),
+		srcG(src.getGreenOffset()),
+		srcB(src.getBlueOffset()),
+		srcA(src.getAlphaOffset())
+	{
+		sameLayout = src.getPixelInc() == inc && srcR == r && srcG == g && srcB == b && (!alpha || srcA == a);
+	}
+
+	void operator()(uint8_t* pixel, const uint8_t* src) const
+	{
+		if(sameLayout)
+		{
+			memcpy(pixel, src, inc);
+			return;
+		}
+		pixel[r] = src[srcR];
+		pixel[g] = src[srcG];
+		pixel[b] = src[srcB];
+		if(alpha)
+			pixel[a] = (srcA < 0) ? 255 : src[srcA];
+	}
+
+	int inc;
+	int r, g, b, a;
+	bool alpha;
+	int srcR, srcG, srcB, srcA;
+	bool sameLayout;
+};
+
+//samples a span of positions at once, samplers that can do better than one call per position overload this
+template<class Sampler>
+void _sampleSpan(const Sampler& sampler, const float* xs, const float* ys, int count, ColorA8u* out)
+{
+	for(int i = 0; i < count; i++)
+		out[i] = sampler(xs[i], ys[i]);
+}
+
+void _sampleSpan(const BilinearSampler& sampler, const float* xs, const float* ys, int count, ColorA8u* out)
+{
+	sampler.sample(xs, ys, count, out);
+}
+
+void _sampleSpan(const BicubicSampler& sampler, const float* xs, const float* ys, int count, ColorA8u* out)
+{
+	sampler.sample(xs, ys, count, out);
+}
+
+//writes the samples at up to TILE_SIZE positions to consecutive pixels
+template<class Sampler>
+void _drawSamples(const Sampler& sampler, const PixelWriter& writer, uint8_t* pixel, const float* xs, const float* ys, int count)
+{
+	assert(count <= TILE_SIZE);
+	ColorA8u colors[TILE_SIZE];
+	_sampleSpan(sampler, xs, ys, count, colors);
+	for(int i = 0; i < count; i++, pixel += writer.inc)
+		writer.set(pixel, colors[i]);
+}
+
+//32.32 fixed point
+inline int64_t _toFixed(double v)
+{
+	return (int64_t)floor(v * 4294967296.0 + 0.5);
+}
+
+inline float _fromFixed(int64_t v)
+{
+	return (float)(v * (1.0 / 4294967296.0));
+}
+
+inline int64_t _floorDiv(int64_t a, int64_t b)
+{
+	int64_t q = a / b;
+	return (q * b != a && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+inline int64_t _ceilDiv(int64_t a, int64_t b)
+{
+	return -_floorDiv(-a, b);
+}
+
+//narrows [from, to) down to the x for which 0 <= v + x * step < limit, an empty span ends up within [from, to] too
+void _clipSpan(int64_t v, int64_t step, int64_t limit, int& from, int& to)
+{
+	int64_t end = to;
+	int64_t lo = from;
+	int64_t hi = to;
+	if(step > 0)
+	{
+		lo = std::max(lo, _ceilDiv(-v, step));
+		hi = std::min(hi, _ceilDiv(limit - v, step));
+	}
+	else if(step < 0)
+	{
+		lo = std::max(lo, _floorDiv(v - limit, -step) + 1);
+		hi = std::min(hi, _floorDiv(v, -step) + 1);
+	}
+	else if(v < 0 || v >= limit)
+		hi = lo;
+	from = (int)std::min(lo, end);
+	to = (int)std::max((int64_t)from, hi);
+}
+
+//narrows [lo, hi] down to the x for which a + b * x >= 0
+void _clipSpan(double a, double b, double& lo, double& hi)
+{
+	if(b > 0)
+		lo = std::max(lo, -a / b);
+	else if(b < 0)
+		hi = std::min(hi, -a / b);
+	else if(a < 0)
+		hi = lo - 1;
+}
+
+template<class Inside>
+void _refineSpan(const Inside& inside, int width, int& from, int& to)
+{
+	//an analytic span can be off by rounding, move its ends to where the per pixel test flips
+	while(from < to && !inside(from))
+		from++;
+	while(from > 0 && inside(from - 1))
+		from--;
+	while(to > from && !inside(to - 1))
+		to--;
+	while(to < width && inside(to))
+		to++;
+}
+
+//the span is found for the whole row so that it doesn't depend on how the target is split into tiles
+void _clipToTile(const Area& tile, int& from, int& to)
+{
+	from = constrain(from, tile.x1, tile.x2);
+	to = constrain(to, from, tile.x2);
+}
+
+//fills the pixels [x1, x2) of a row whose source coordinate is (fx, fy) at x = 0 and moves by (stepX, stepY) per pixel
 template<class Sampler>
-void _drawProjective(Sampler& sampler, TransformMapping& srcMapping, Surface& dest, TransformMapping& destMapping)
+void _drawAffineRow(const Sampler& sampler, const PixelWriter& writer, uint8_t* row, int64_t fx, int64_t fy, int64_t stepX, int64_t stepY, int x1, int x2)
+{
+	int64_t limitX = _toFixed(sampler.source.getWidth());
+	int64_t limitY = _toFixed(sampler.source.getHeight());
+	int from = x1;
+	int to = x2;
+	//when both ends land inside the source so does everything in between, otherwise solve for the span
+	int64_t lastX = fx + (x2 - 1) * stepX;
+	int64_t lastY = fy + (x2 - 1) * stepY;
+	int64_t firstX = fx + x1 * stepX;
+	int64_t firstY = fy + x1 * stepY;
+	if(std::min(firstX, lastX) < 0 || std::min(firstY, lastY) < 0 || std::max(firstX, lastX) >= limitX || std::max(firstY, lastY) >= limitY)
+	{
+		_clipSpan(fx, stepX, limitX, from, to);
+		_clipSpan(fy, stepY, limitY, from, to);
+	}
+
+	writer.clear(row + x1 * writer.inc, from - x1);
+	fx += from * stepX;
+	fy += from * stepY;
+	float xs[TILE_SIZE];
+	float ys[TILE_SIZE];
+	for(int i = 0; i < to - from; i++, fx += stepX, fy += stepY)
+	{
+		xs[i] = _fromFixed(fx);
+		ys[i] = _fromFixed(fy);
+	}
+	_drawSamples(sampler, writer, row + from * writer.inc, xs, ys, to - from);
+	writer.clear(row + to * writer.inc, x2 - to);
+}
+
+template<class Sampler>
+void _drawAffine(const Sampler& sampler, const Matrix33f& m, Surface& dest, const Area& tile)
+{
+	/*
+	Without perspective the source coordinate changes by the same amount from one target pixel to the next.
+	It's stepped along each row in fixed point, so a pixel costs two integer additions and no divide, and
+	the span of pixels that land inside the source is solved for exactly before the row is walked.
+	*/
+	PixelWriter writer(dest);
+	double norm = 1.0 / m.m22;
+	int64_t stepX = _toFixed(m.m00 * norm);
+	int64_t stepY = _toFixed(m.m10 * norm);
+	for(int y = tile.y1; y < tile.y2; y++)
+	{
+		int64_t fx = _toFixed((m.m01 * y + m.m02) * norm);
+		int64_t fy = _toFixed((m.m11 * y + m.m12) * norm);
+		_drawAffineRow(sampler, writer, dest.getData(Vec2i(0, y)), fx, fy, stepX, stepY, tile.x1, tile.x2);
+	}
+}
+
+//1 or -1 by the winding of a convex quad, 0 if the quad isn't convex
+float _turnSign(const Vec2f* quad)
+{
+	float turns[4];
+	for(int i = 0; i < 4; i++)
+		turns[i] = (quad[(i + 1) % 4] - quad[i]).cross(quad[(i + 2) % 4] - quad[(i + 1) % 4]);
+	float sign = turns[0] < 0 ? -1.0f : 1.0f;
+	for(int i = 0; i < 4; i++)
+		if(sign * turns[i] <= 0)
+			return 0;
+	return sign;
+}
+
+//true if the quad is convex and all pixels of the cell lie outside of it
+bool _outsideQuad(const Area& cell, const Vec2f* quad)
+{
+	float sign = _turnSign(quad);
+	if(sign == 0)
+		return false;
+
+	const Vec2f corners[4] = { Vec2f(cell.x1, cell.y1), Vec2f(cell.x2 - 1, cell.y1), Vec2f(cell.x1, cell.y2 - 1), Vec2f(cell.x2 - 1, cell.y2 - 1) };
+	for(int i = 0; i < 4; i++)
+	{
+		Vec2f edge = quad[(i + 1) % 4] - quad[i];
+		float margin = EPSILON * edge.length();
+		bool outside = true;
+		for(int k = 0; k < 4 && outside; k++)
+			outside = sign * edge.cross(corners[k] - quad[i]) < -margin;
+		if(outside)
+			return true;
+	}
+	return false;
+}
+
+/*
+Draws a warp that isn't affine as a mesh of affine pieces. Over a cell the warp is replaced by the affine map
+that fits its corners best (through their center, with the mean slopes of opposite edges). Where that is off
+by more than the tolerance at a corner, the center or the middle of an edge the cell is split in four. Cells
+that get too small are drawn pixel by pixel. Both warps map the target quad onto the source rect, so cells
+outside the quad are blank.
+*/
+template<class Sampler, class Warp>
+void _drawMesh(const Sampler& sampler, const Warp& warp, const Vec2f* quad, Surface& dest, const Area& cell, double tolerance)
+{
+	PixelWriter writer(dest);
+	if(_outsideQuad(cell, quad))
+	{
+		for(int y = cell.y1; y < cell.y2; y++)
+			writer.clear(dest.getData(Vec2i(cell.x1, y)), cell.x2 - cell.x1);
+		return;
+	}
+
+	int x1 = cell.x1;
+	int y1 = cell.y1;
+	int x2 = cell.x2;
+	int y2 = cell.y2;
+	int xm = (x1 + x2) / 2;
+	int ym = (y1 + y2) / 2;
+	const int probes[][2] = { {x1, y1}, {x2, y1}, {x1, y2}, {x2, y2}, {xm, ym}, {xm, y1}, {x1, ym}, {x2, ym}, {xm, y2} };
+	Vec2d exact[9];
+	for(int i = 0; i < 4; i++)
+		exact[i] = warp(probes[i][0], probes[i][1]);
+	Vec2d dx = (exact[1] - exact[0] + exact[3] - exact[2]) / (2.0 * (x2 - x1));
+	Vec2d dy = (exact[2] - exact[0] + exact[3] - exact[1]) / (2.0 * (y2 - y1));
+	Vec2d center = (exact[0] + exact[1] + exact[2] + exact[3]) * 0.25;
+	double cx = 0.5 * (x1 + x2);
+	double cy = 0.5 * (y1 + y2);
+	bool fits = true;
+	for(int i = 0; i < 9 && fits; i++)
+	{
+		if(i >= 4)
+			exact[i] = warp(probes[i][0], probes[i][1]);
+		Vec2d affine = center + dx * (probes[i][0] - cx) + dy * (probes[i][1] - cy);
+		//written so that a warp that blows up (NaN) doesn't fit
+		fits = std::abs(exact[i].x - affine.x) <= tolerance && std::abs(exact[i].y - affine.y) <= tolerance;
+	}
+
+	if(fits)
+	{
+		int64_t stepX = _toFixed(dx.x);
+		int64_t stepY = _toFixed(dx.y);
+		for(int y = y1; y < y2; y++)
+		{
+			Vec2d start = center + dy * (y - cy) - dx * cx;
+			_drawAffineRow(sampler, writer, dest.getData(Vec2i(0, y)), _toFixed(start.x), _toFixed(start.y), stepX, stepY, x1, x2);
+		}
+	}
+	else if(x2 - x1 > MIN_CELL_SIZE || y2 - y1 > MIN_CELL_SIZE)
+	{
+		int sx = (x2 - x1 > MIN_CELL_SIZE) ? xm : x2;
+		int sy = (y2 - y1 > MIN_CELL_SIZE) ? ym : y2;
+		_drawMesh(sampler, warp, quad, dest, Area(x1, y1, sx, sy), tolerance);
+		if(sx < x2)
+			_drawMesh(sampler, warp, quad, dest, Area(sx, y1, x2, sy), tolerance);
+		if(sy < y2)
+			_drawMesh(sampler, warp, quad, dest, Area(x1, sy, sx, y2), tolerance);
+		if(sx < x2 && sy < y2)
+			_drawMesh(sampler, warp, quad, dest, Area(sx, sy, x2, y2), tolerance);
+	}
+	else
+	{
+		float srcWidth = sampler.source.getWidth();
+		float srcHeight = sampler.source.getHeight();
+		for(int y = y1; y < y2; y++)
+		{
+			uint8_t* pixel = dest.getData(Vec2i(x1, y));
+			for(int x = x1; x < x2; x++, pixel += writer.inc)
+			{
+				Vec2d p = warp(x, y);
+				float srcX = (float)p.x;
+				float srcY = (float)p.y;
+				if(srcX >= 0 && srcY >= 0 && srcX < srcWidth && srcY < srcHeight)
+					_drawSamples(sampler, writer, pixel, &srcX, &srcY, 1);
+				else
+					writer.clear(pixel, 1);
+			}
+		}
+	}
+}
+
+//maps a target position to the source, for drawing a projective warp as a mesh
+struct ProjectiveWarp
+{
+	ProjectiveWarp(const Matrix33f& targetToSource) : m(targetToSource) {}
+
+	Vec2d operator()(int x, int y) const
+	{
+		double w = 1.0 / (m.m20 * x + m.m21 * y + m.m22);
+		return Vec2d((m.m00 * x + m.m01 * y + m.m02) * w, (m.m10 * x + m.m11 * y + m.m12) * w);
+	}
+
+	Matrix33f m;
+};
+
+//calculate matrix mapping each pixel in target to a coordinate in source
+Matrix33f _targetToSource(TransformMapping& srcMapping, TransformMapping& destMapping)
 {
-	//calculate matrix mapping each pixel in target to a coordinate in source
 	Matrix33f uvToTarget = _mapUnitSquareToQuad(destMapping.localQuad);
 	Matrix33f targetToUV = uvToTarget.inverted();
 	Matrix33f uvToSource = _mapUnitSquareToQuad(srcMapping.localQuad);
-	Matrix33f targetToSource = uvToSource * targetToUV;
+	return uvToSource * targetToUV;
+}
+
+template<class Sampler>
+void _drawProjective(const Sampler& sampler, TransformMapping& srcMapping, Surface& dest, TransformMapping& destMapping, const Area& tile, double tolerance)
+{
+	Matrix33f m = _targetToSource(srcMapping, destMapping);
+	//parallelograms map onto the source rect without perspective (see _mapUnitSquareToQuad)
+	if(m.m20 == 0 && m.m21 == 0)
+	{
+		_drawAffine(sampler, m, dest, tile);
+		return;
+	}
+	if(tolerance > 0)
+	{
+		_drawMesh(sampler, ProjectiveWarp(m), destMapping.localQuad, dest, tile, tolerance);
+		return;
+	}
 
 	//for each target pixel find one in source!
 	float srcWidth = sampler.source.getWidth();
 	float srcHeight = sampler.source.getHeight();
-	Color8u blank = Color8u();
-	for(int x = 0; x < dest.getWidth(); x++)
-		for(int y = 0; y < dest.getHeight(); y++)
+	int width = dest.getWidth();
+	PixelWriter writer(dest);
+	//the quad lies on one side of the horizon (hz = 0), its center tells which
+	Vec2f center = (destMapping.localQuad[0] + destMapping.localQuad[2]) * 0.5f;
+	double side = (m.m20 * center.x + m.m21 * center.y + m.m22) < 0 ? -1.0 : 1.0;
+	for(int y = tile.y1; y < tile.y2; y++)
+	{
+		double hx = m.m01 * y + m.m02;
+		double hy = m.m11 * y + m.m12;
+		double hz = m.m21 * y + m.m22;
+		auto inside = [&](int x) -> bool
 		{
-			Vec3f vSrc = targetToSource.transformVec(Vec3f(x,y,1));
-			vSrc /= vSrc.z;
-			if(vSrc.x >= 0 && vSrc.y >= 0 && vSrc.x < srcWidth && vSrc.y < srcHeight)
-				dest.setPixel(Vec2i(x,y), sampler(vSrc.x, vSrc.y) );
-			else
-				dest.setPixel(Vec2i(x,y), blank);
+			double w = 1.0 / (hz + x * m.m20);
+			float srcX = (float)((hx + x * m.m00) * w);
+			float srcY = (float)((hy + x * m.m10) * w);
+			return srcX >= 0 && srcY >= 0 && srcX < srcWidth && srcY < srcHeight;
+		};
+
+		//the source rect as linear constraints on x, then fixed up with the exact test
+		double lo = 0;
+		double hi = width - 1;
+		_clipSpan(side * hz, side * m.m20, lo, hi);
+		_clipSpan(side * hx, side * m.m00, lo, hi);
+		_clipSpan(side * hy, side * m.m10, lo, hi);
+		_clipSpan(side * (srcWidth * hz - hx), side * (srcWidth * m.m20 - m.m00), lo, hi);
+		_clipSpan(side * (srcHeight * hz - hy), side * (srcHeight * m.m20 - m.m10), lo, hi);
+		int from = lo <= hi ? (int)ceil(lo) : 0;
+		int to = lo <= hi ? (int)floor(hi) + 1 : 0;
+		_refineSpan(inside, width, from, to);
+		_clipToTile(tile, from, to);
+
+		uint8_t* row = dest.getData(Vec2i(0, y));
+		writer.clear(row + tile.x1 * writer.inc, from - tile.x1);
+		//the homogeneous coordinate is evaluated the same way as in the test
+		float xs[TILE_SIZE];
+		float ys[TILE_SIZE];
+		for(int x = from; x < to; x++)
+		{
+			double w = 1.0 / (hz + x * m.m20);
+			xs[x - from] = (float)((hx + x * m.m00) * w);
+			ys[x - from] = (float)((hy + x * m.m10) * w);
 		}
+		_drawSamples(sampler, writer, row + from * writer.inc, xs, ys, to - from);
+		writer.clear(row + to * writer.inc, tile.x2 - to);
+	}
 }
 
-Vec2f _transformInvBilinear(Vec2f p, Vec2f* q)
-{	
-	//non-inverse is easy: 
-	//p = (1-u)*(1-v)*q[0] + (1-u)*v*q[3] + u*(1-v)*q[1] + u*v*q[2]
-	//solve p.x and p.y to v and get
-	//v = ( (1-u)*(x0-x) + u*(x1-x) ) / ( (1-u)*(x0-x3) + u*(x1-x2) )
-	//v = ( (1-u)*(y0-y) + u*(y1-y) ) / ( (1-u)*(y0-y3) + u*(y1-y2) )
+/*
+Inverts the bilinear mapping of the unit square onto a quad (starting with TOPLEFT clockwise):
 
-	//A*(1-u)^2 + B*2u(1-u) + C*u^2 = 0
-	
-	double A = (q[0]-p).cross(q[0]-q[3]);
-	double B = ((q[0]-p).cross(q[1]-q[2]) + (q[1]-p).cross(q[0]-q[3]) ) / 2;
-	double C = (q[1]-p).cross(q[1]-q[2]);
-
-	//FIND U
-	double u = 0;
-	double div = ( A - 2*B + C );
-	if(std::abs(div) < ci::EPSILON_VALUE)
-		u = ((A-C) != 0) ? A / (A-C) : 0;//U
-	else
+	p = (1-u)*(1-v)*q[0] + (1-u)*v*q[3] + u*(1-v)*q[1] + u*v*q[2]
+
+Solving p.x and p.y to v and equating gives A*(1-u)^2 + B*2u(1-u) + C*u^2 = 0, where A, B and C
+are cross products of the quad's edges with the vectors from p to its corners. They are linear in p so
+along a row of target pixels each of them changes by the same amount per pixel and only needs to be
+set up once per row. Then
+	v = ( (1-u)*(x0-x) + u*(x1-x) ) / ( (1-u)*(x0-x3) + u*(x1-x2) )
+	v = ( (1-u)*(y0-y) + u*(y1-y) ) / ( (1-u)*(y0-y3) + u*(y1-y2) )
+*/
+class InverseBilinear
+{
+public:
+	InverseBilinear(const Vec2f* q)
+	:	mY(0)
 	{
-		u = ( (A-B) + sqrt(B*B - A*C) ) / div;
+		for(int i = 0; i < 4; i++)
+			mQ[i] = Vec2d(q[i].x, q[i].y);
+		mLeft = mQ[0] - mQ[3];
+		mRight = mQ[1] - mQ[2];
+		mStepA = -mLeft.y;
+		mStepB = -(mRight.y + mLeft.y) / 2;
+		mStepC = -mRight.y;
+	}
+
+	void setRow(int y)
+	{
+		mY = y;
+		mA = _cross(mQ[0].x, mQ[0].y - y, mLeft);
+		mB = (_cross(mQ[0].x, mQ[0].y - y, mRight) + _cross(mQ[1].x, mQ[1].y - y, mLeft)) / 2;
+		mC = _cross(mQ[1].x, mQ[1].y - y, mRight);
+	}
+
+	//u of pixel x in the current row, in closed form
+	double solve(int x) const
+	{
+		double A = mA + x * mStepA;
+		double B = mB + x * mStepB;
+		double C = mC + x * mStepC;
+		double div = ( A - 2*B + C );
+		if(std::abs(div) < ci::EPSILON_VALUE)
+			return ((A-C) != 0) ? A / (A-C) : 0;
+		double u = ( (A-B) + sqrt(B*B - A*C) ) / div;
 		if(u < 0 || u > 1)
 			u = ( (A-B) - sqrt(B*B - A*C) ) / div;
+		return u;
 	}
 
-	//FIND V
-	double v = 0;
-	Vec2f vDiv = (1-u)*(q[0]-q[3]) + u*(q[1]-q[2]);
-	if(abs(vDiv.x) > abs(vDiv.y))
-		v = ( (1-u)*(q[0].x-p.x) + u*(q[1].x-p.x) ) / vDiv.x;
-	else if(vDiv.y != 0)
-		v = ( (1-u)*(q[0].y-p.y) + u*(q[1].y-p.y) ) / vDiv.y;
-	
-	return Vec2f((float)u,(float)v);
-}
+	/*
+	u of pixel x in the current row, found with Newton's method starting from a guess (e.g. extrapolated
+	from the pixels before). Close guesses settle after a single step, otherwise it falls back to solve().
+	*/
+	double track(int x, double guess) const
+	{
+		double A = mA + x * mStepA;
+		double B = mB + x * mStepB;
+		double C = mC + x * mStepC;
+		double div = A - 2*B + C;
+		double u = guess;
+		for(int i = 0; i < 3; i++)
+		{
+			double slope = 2 * (div * u + B - A);
+			if(slope == 0)
+				break;
+			double step = ((div * u + 2 * (B - A)) * u + A) / slope;
+			u -= step;
+			//the error left after a step is in the order of step^2
+			if(std::abs(step) < 1e-6)
+				return (u >= 0 && u <= 1) ? u : solve(x);
+		}
+		return solve(x);
+	}
+
+	Vec2f uv(int x, double u) const
+	{
+		double v = 0;
+		Vec2d vDiv = (1-u)*mLeft + u*mRight;
+		if(std::abs(vDiv.x) > std::abs(vDiv.y))
+			v = ( (1-u)*(mQ[0].x-x) + u*(mQ[1].x-x) ) / vDiv.x;
+		else if(vDiv.y != 0)
+			v = ( (1-u)*(mQ[0].y-mY) + u*(mQ[1].y-mY) ) / vDiv.y;
+		return Vec2f((float)u,(float)v);
+	}
+
+private:
+	//(q - p) x edge for p = (0, y), with dy = q.y - y
+	static double _cross(double qx, double dy, const Vec2d& edge)
+	{
+		return qx * edge.y - dy * edge.x;
+	}
+
+	Vec2d mQ[4];
+	Vec2d mLeft;
+	Vec2d mRight;
+	double mA, mB, mC;
+	double mStepA, mStepB, mStepC;
+	int mY;
+};
+
+//maps a target position to the source, for drawing a bilinear warp as a mesh
+struct BilinearWarp
+{
+	BilinearWarp(const Vec2f* quad, const Matrix33f& uvToSource) : inverse(quad), uvToSource(uvToSource) {}
+
+	Vec2d operator()(int x, int y) const
+	{
+		InverseBilinear row = inverse;
+		row.setRow(y);
+		Vec3f vSrc = uvToSource.transformVec(Vec3f(row.uv(x, row.solve(x)), 1));
+		return Vec2d(vSrc.x / vSrc.z, vSrc.y / vSrc.z);
+	}
+
+	InverseBilinear inverse;
+	Matrix33f uvToSource;
+};
 
 template<class Sampler>
-void _drawBilinear(Sampler& sampler, TransformMapping& srcMapping, Surface& dest, TransformMapping& destMapping)
+void _drawBilinear(const Sampler& sampler, TransformMapping& srcMapping, Surface& dest, TransformMapping& destMapping, const Area& tile, double tolerance)
 {
 	Matrix33f uvToSource = _mapUnitSquareToQuad(srcMapping.localQuad);
+	if(tolerance > 0)
+	{
+		_drawMesh(sampler, BilinearWarp(destMapping.localQuad, uvToSource), destMapping.localQuad, dest, tile, tolerance);
+		return;
+	}
 
 	//for each target pixel find one in source!
 	float srcWidth = sampler.source.getWidth();
 	float srcHeight = sampler.source.getHeight();
-	Color8u blank = Color8u();
-	for(int x = 0; x < dest.getWidth(); x++)
-		for(int y = 0; y < dest.getHeight(); y++)
+	int width = dest.getWidth();
+	PixelWriter writer(dest);
+	Vec2f* quad = destMapping.localQuad;
+	InverseBilinear inverse(quad);
+	bool convex = _turnSign(quad) != 0;
+	float xs[TILE_SIZE];
+	float ys[TILE_SIZE];
+	for(int y = tile.y1; y < tile.y2; y++)
+	{
+		inverse.setRow(y);
+		uint8_t* row = dest.getData(Vec2i(0, y));
+		auto source = [&](int x, double u) -> Vec3f
+		{
+			Vec3f vSrc = uvToSource.transformVec(Vec3f(inverse.uv(x, u),1));
+			return vSrc * (1 / vSrc.z);
+		};
+		auto within = [&](const Vec3f& vSrc) -> bool
 		{
-			float u = (x+0.5) / (float)dest.getWidth();
-			float v = (y+0.5) / (float)dest.getHeight();
-			Vec2f uv = _transformInvBilinear(Vec2f(x,y), destMapping.localQuad);
-			if(u >= 0 && u <= 1 && v >= 0 && v <= 1)
+			return vSrc.x >= 0 && vSrc.y >= 0 && vSrc.x < srcWidth && vSrc.y < srcHeight;
+		};
+		auto inside = [&](int x) -> bool
+		{
+			return within(source(x, inverse.solve(x)));
+		};
+
+		if(!convex)
+		{
+			//a concave quad can cover the row in more than one run, so every pixel gets the exact test
+			int count = 0;
+			for(int x = tile.x1; x <= tile.x2; x++)
 			{
-				Vec3f vSrc = uvToSource.transformVec(Vec3f(uv,1));
-				vSrc /= vSrc.z;
-				if(vSrc.x >= 0 && vSrc.y >= 0 && vSrc.x < srcWidth && vSrc.y < srcHeight)
-					dest.setPixel(Vec2i(x,y), sampler(vSrc.x, vSrc.y) );
-				else
-					dest.setPixel(Vec2i(x,y), blank);
-			};
-		}	
+				if(x < tile.x2)
+				{
+					Vec3f vSrc = source(x, inverse.solve(x));
+					if(within(vSrc))
+					{
+						xs[count] = vSrc.x;
+						ys[count] = vSrc.y;
+						count++;
+						continue;
+					}
+					writer.clear(row + x * writer.inc, 1);
+				}
+				_drawSamples(sampler, writer, row + (x - count) * writer.inc, xs, ys, count);
+				count = 0;
+			}
+			continue;
+		}
+
+		//the pixels inside the quad are where the row crosses its edges, then fixed up with the exact test
+		float lo = (float)width;
+		float hi = -1;
+		for(int i = 0; i < 4; i++)
+		{
+			Vec2f a = quad[i];
+			Vec2f b = quad[(i + 1) % 4];
+			if((a.y <= y && b.y >= y) || (b.y <= y && a.y >= y))
+			{
+				float x = (a.y == b.y) ? std::min(a.x, b.x) : a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y);
+				float xEnd = (a.y == b.y) ? std::max(a.x, b.x) : x;
+				lo = std::min(lo, x);
+				hi = std::max(hi, xEnd);
+			}
+		}
+		int from = constrain((int)ceil(lo), 0, width);
+		int to = constrain((int)floor(hi) + 1, from, width);
+		_refineSpan(inside, width, from, to);
+		_clipToTile(tile, from, to);
+
+		writer.clear(row + tile.x1 * writer.inc, from - tile.x1);
+		//u varies smoothly along the row, the two pixels before predict it well enough for track()
+		double u = 0;
+		double uBefore = 0;
+		for(int x = from; x < to; x++)
+		{
+			double next = (x - from < 2) ? inverse.solve(x) : inverse.track(x, 2 * u - uBefore);
+			uBefore = u;
+			u = next;
+			Vec3f vSrc = source(x, u);
+			xs[x - from] = vSrc.x;
+			ys[x - from] = vSrc.y;
+		}
+		_drawSamples(sampler, writer, row + from * writer.inc, xs, ys, to - from);
+		writer.clear(row + to * writer.inc, tile.x2 - to);
+	}
 }
 
+//samplers that return the source pixel itself at whole coordinates
 template<class Sampler>
-Surface pp::transform(Sampler& sampler, TransformMapping& targetMapping, TransformMethod method)
+bool _copiesPixels(const Sampler& sampler)
 {
-	if(method == TM_IDENTITY)
-		return sampler.source;
+	return false;
+}
 
-	Surface result(targetMapping.bounds.getWidth(), targetMapping.bounds.getHeight(), sampler.source.hasAlpha());
-	TransformMapping srcMapping(sampler.source.getBounds());
+bool _copiesPixels(const NearestNeighbourSampler& sampler)
+{
+	return true;
+}
+
+//all four neighbours are the same pixel there, so it's the only colour to choose from
+bool _copiesPixels(const BilinearDominanceSampler& sampler)
+{
+	return true;
+}
+
+#ifdef PP_SSE2
+//four pixels from src on, going backwards in memory if reversed
+inline __m128i _loadRun(const uint8_t* src, bool reversed)
+{
+	if(!reversed)
+		return _mm_loadu_si128((const __m128i*)src);
+	return _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(src - 12)), _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+inline void _transpose4x4(__m128i& r0, __m128i& r1, __m128i& r2, __m128i& r3)
+{
+	__m128i t0 = _mm_unpacklo_epi32(r0, r1);
+	__m128i t1 = _mm_unpacklo_epi32(r2, r3);
+	__m128i t2 = _mm_unpackhi_epi32(r0, r1);
+	__m128i t3 = _mm_unpackhi_epi32(r2, r3);
+	r0 = _mm_unpacklo_epi64(t0, t1);
+	r1 = _mm_unpackhi_epi64(t0, t1);
+	r2 = _mm_unpacklo_epi64(t2, t3);
+	r3 = _mm_unpackhi_epi64(t2, t3);
+}
+#endif
+
+//count target pixels from a source row, step is the distance in bytes from one source pixel to the next
+void _copyRow(const PixelCopier& copy, uint8_t* pixel, const uint8_t* src, ptrdiff_t step, int count)
+{
+	if(copy.sameLayout && step == copy.inc)
+	{
+		memcpy(pixel, src, count * copy.inc);
+		return;
+	}
+	int i = 0;
+#ifdef PP_SSE2
+	if(copy.sameLayout && copy.inc == 4 && step == -4)
+		for(; i + 4 <= count; i += 4, pixel += 16, src -= 16)
+			_mm_storeu_si128((__m128i*)pixel, _loadRun(src, true));
+#endif
+	for(; i < count; i++, pixel += copy.inc, src += step)
+		copy(pixel, src);
+}
+
+/*
+Target rows [x1, x2) that run along source columns. The source pixel of rows[j] at x is
+first + (x - x1) * strideX + j * strideY, reading down a column for each target row would touch a new
+cache line per pixel so the rows are filled block by block instead.
+*/
+void _copyTransposed(const PixelCopier& copy, uint8_t* const* rows, int count, int x1, int x2, const uint8_t* first, ptrdiff_t strideX, ptrdiff_t strideY)
+{
+	for(int bx = x1; bx < x2; bx += LOSSLESS_BLOCK)
+	{
+		int bx2 = std::min(bx + LOSSLESS_BLOCK, x2);
+		int j = 0;
+#ifdef PP_SSE2
+		//4x4 pixels at a time, each source run of four becomes a column of the target
+		if(copy.sameLayout && copy.inc == 4)
+			for(; j + 4 <= count; j += 4)
+			{
+				int x = bx;
+				for(; x + 4 <= bx2; x += 4)
+				{
+					const uint8_t* src = first + (x - x1) * strideX + j * strideY;
+					__m128i r0 = _loadRun(src, strideY < 0);
+					__m128i r1 = _loadRun(src + strideX, strideY < 0);
+					__m128i r2 = _loadRun(src + 2 * strideX, strideY < 0);
+					__m128i r3 = _loadRun(src + 3 * strideX, strideY < 0);
+					_transpose4x4(r0, r1, r2, r3);
+					_mm_storeu_si128((__m128i*)(rows[j] + x * 4), r0);
+					_mm_storeu_si128((__m128i*)(rows[j + 1] + x * 4), r1);
+					_mm_storeu_si128((__m128i*)(rows[j + 2] + x * 4), r2);
+					_mm_storeu_si128((__m128i*)(rows[j + 3] + x * 4), r3);
+				}
+				for(; x < bx2; x++)
+					for(int k = j; k < j + 4; k++)
+						copy(rows[k] + x * 4, first + (x - x1) * strideX + k * strideY);
+			}
+#endif
+		for(; j < count; j++)
+			for(int x = bx; x < bx2; x++)
+				copy(rows[j] + x * copy.inc, first + (x - x1) * strideX + j * strideY);
+	}
+}
+
+/*
+Rotations by multiples of 90 degrees and mirrors put every target pixel exactly onto a source pixel. For
+samplers that return that pixel as it is (see _copiesPixels) nothing needs to be sampled, the rows are
+copied over (backwards for mirrors) or, when the source is transposed, assembled from its columns.
+Returns false without drawing anything if the mapping isn't one of those.
+*/
+template<class Sampler>
+bool _drawLossless(const Sampler& sampler, TransformMapping& srcMapping, Surface& dest, TransformMapping& destMapping)
+{
+	if(!_copiesPixels(sampler))
+		return false;
+	Matrix33f m = _targetToSource(srcMapping, destMapping);
+	const Surface& src = sampler.source;
+	int width = dest.getWidth();
+	int height = dest.getHeight();
+	double norm = 1.0 / m.m22;
+	if(std::abs(m.m20 * norm) * width + std::abs(m.m21 * norm) * height > LOSSLESS_EPSILON)
+		return false;
+	//source pixel of target (x, y) is (e[0] * x + e[1] * y + e[2], e[3] * x + e[4] * y + e[5])
+	double coefficients[6] = { m.m00, m.m01, m.m02, m.m10, m.m11, m.m12 };
+	int e[6];
+	for(int i = 0; i < 6; i++)
+	{
+		double c = coefficients[i] * norm;
+		e[i] = (int)floor(c + 0.5);
+		if(std::abs(c - e[i]) > LOSSLESS_EPSILON)
+			return false;
+	}
+	if(std::abs(e[0]) + std::abs(e[1]) != 1 || std::abs(e[3]) + std::abs(e[4]) != 1 || std::abs(e[0]) != std::abs(e[4]))
+		return false;
+
+	//each target axis moves along one source axis only, so the pixels that land inside form a rect
+	int x1 = 0;
+	int x2 = width;
+	int y1 = 0;
+	int y2 = height;
+	if(e[0] != 0)
+	{
+		_clipSpan(e[2], e[0], src.getWidth(), x1, x2);
+		_clipSpan(e[5], e[4], src.getHeight(), y1, y2);
+	}
+	else
+	{
+		_clipSpan(e[5], e[3], src.getHeight(), x1, x2);
+		_clipSpan(e[2], e[1], src.getWidth(), y1, y2);
+	}
+	const uint8_t* data = src.getData();
+	ptrdiff_t strideX = e[0] * src.getPixelInc() + e[3] * src.getRowBytes();
+	ptrdiff_t strideY = e[1] * src.getPixelInc() + e[4] * src.getRowBytes();
+	ptrdiff_t origin = e[2] * src.getPixelInc() + e[5] * src.getRowBytes();
+
+	int bands = (height + LOSSLESS_BLOCK - 1) / LOSSLESS_BLOCK;
+	parallelFor(bands, [&](int band)
+	{
+		PixelWriter writer(dest);
+		PixelCopier copy(src, writer);
+		int top = band * LOSSLESS_BLOCK;
+		int bottom = std::min(top + LOSSLESS_BLOCK, height);
+		uint8_t* rows[LOSSLESS_BLOCK];
+		for(int y = top; y < bottom; y++)
+		{
+			uint8_t* row = dest.getData(Vec2i(0, y));
+			rows[y - top] = row;
+			if(y < y1 || y >= y2)
+				writer.clear(row, width);
+			else
+			{
+				writer.clear(row, x1);
+				writer.clear(row + x2 * writer.inc, width - x2);
+			}
+		}
+		top = std::max(top, y1);
+		bottom = std::min(bottom, y2);
+		if(top >= bottom || x1 >= x2)
+			return;
+		const uint8_t* first = data + origin + x1 * strideX + top * strideY;
+		if(e[0] != 0)
+			for(int y = top; y < bottom; y++)
+				_copyRow(copy, rows[y - band * LOSSLESS_BLOCK] + x1 * writer.inc, first + (y - top) * strideY, strideX, x2 - x1);
+		else
+			_copyTransposed(copy, rows + (top - band * LOSSLESS_BLOCK), bottom - top, x1, x2, first, strideX, strideY);
+	});
+	return true;
+}
+
+int _tileCount(const Surface& dest)
+{
+	return ((dest.getWidth() + TILE_SIZE - 1) / TILE_SIZE) * ((dest.getHeight() + TILE_SIZE - 1) / TILE_SIZE);
+}
+
+template<class Sampler>
+void _drawTile(const Sampler& sampler, TransformMapping& srcMapping, Surface& dest, TransformMapping& destMapping, TransformMethod method, int index, double tolerance)
+{
+	int width = dest.getWidth();
+	int height = dest.getHeight();
+	int columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int x = (index % columns) * TILE_SIZE;
+	int y = (index / columns) * TILE_SIZE;
+	Area tile(x, y, std::min(x + TILE_SIZE, width), std::min(y + TILE_SIZE, height));
 	switch(method)
 	{
+	case TM_IDENTITY:
+		assert(false); //returned as is, never drawn
+		break;
 	case TM_PROJECTIVE:
-		_drawProjective(sampler, srcMapping, result, targetMapping);
+		_drawProjective(sampler, srcMapping, dest, destMapping, tile, tolerance);
 		break;
 	case TM_BILINEAR:
-		_drawBilinear(sampler, srcMapping, result, targetMapping);
+		_drawBilinear(sampler, srcMapping, dest, destMapping, tile, tolerance);
 		break;
-	}	
+	}
+}
+
+template<class Sampler>
+Surface pp::transform(const Sampler& sampler, TransformMapping& targetMapping, TransformMethod method, float tolerance)
+{
+	if(method == TM_IDENTITY)
+		return sampler.source;
+
+	Surface result(targetMapping.bounds.getWidth(), targetMapping.bounds.getHeight(), sampler.source.hasAlpha());
+	TransformMapping srcMapping(sampler.source.getBounds());
+	if(_drawLossless(sampler, srcMapping, result, targetMapping))
+		return result;
+	//tiles differ a lot in cost (those along the edges are mostly blank) so they are balanced by stealing
+	parallelForStealing(_tileCount(result), [&](int i)
+	{
+		_drawTile(sampler, srcMapping, result, targetMapping, method, i, tolerance);
+	});
 	return result;
 }
 
-//****** SAMPLER ******
+/*
+Shelf packing: the frames are placed in rows from left to right, tallest first, and a row is as tall as
+its first frame. Rows are about as wide as the atlas would be if it was square. Returns the atlas size.
+*/
+Vec2i _packFrames(std::vector<Area>& frames)
+{
+	std::vector<int> order(frames.size());
+	int area = 0;
+	int widest = 0;
+	for(size_t i = 0; i < frames.size(); i++)
+	{
+		order[i] = (int)i;
+		area += (frames[i].getWidth() + ATLAS_PADDING) * (frames[i].getHeight() + ATLAS_PADDING);
+		widest = std::max(widest, frames[i].getWidth());
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return frames[a].getHeight() > frames[b].getHeight(); });
+	int rowWidth = std::max(widest, (int)ceil(sqrt((double)area)));
+
+	Vec2i size(0, 0);
+	int x = 0;
+	int y = 0;
+	int rowHeight = 0;
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		Area& frame = frames[order[i]];
+		if(x > 0 && x + frame.getWidth() > rowWidth)
+		{
+			x = 0;
+			y += rowHeight + ATLAS_PADDING;
+			rowHeight = 0;
+		}
+		frame.offset(Vec2i(x, y) - frame.getUL());
+		rowHeight = std::max(rowHeight, frame.getHeight());
+		size.x = std::max(size.x, frame.x2);
+		size.y = std::max(size.y, frame.y2);
+		x += frame.getWidth() + ATLAS_PADDING;
+	}
+	return size;
+}
+
+template<class Sampler>
+Surface pp::transform(const Sampler& sampler, std::vector<TransformMapping>& targetMappings, TransformMethod method, std::vector<Area>& frames, float tolerance)
+{
+	int count = (int)targetMappings.size();
+	frames.resize(count);
+	for(int i = 0; i < count; i++)
+	{
+		Rectf bounds = (method == TM_IDENTITY) ? Rectf(sampler.source.getBounds()) : targetMappings[i].bounds;
+		frames[i] = Area(0, 0, (int)bounds.getWidth(), (int)bounds.getHeight());
+	}
+	Vec2i size = _packFrames(frames);
+	Surface atlas(std::max(size.x, 1), std::max(size.y, 1), sampler.source.hasAlpha());
+	//the space between frames stays blank and transparent
+	for(int y = 0; y < atlas.getHeight(); y++)
+		memset(atlas.getData(Vec2i(0, y)), 0, atlas.getWidth() * atlas.getPixelInc());
+
+	//each frame is a surface sharing the atlas' pixels, the whole ones are drawn right away and the tiles of all others in one go
+	std::vector<Surface> dests(count);
+	std::vector<int> firstTile(count + 1, 0);
+	TransformMapping srcMapping(sampler.source.getBounds());
+	for(int i = 0; i < count; i++)
+	{
+		dests[i] = Surface(atlas.getData(frames[i].getUL()), frames[i].getWidth(), frames[i].getHeight(), atlas.getRowBytes(), atlas.getChannelOrder());
+		firstTile[i + 1] = firstTile[i];
+		if(method == TM_IDENTITY)
+		{
+			PixelWriter writer(dests[i]);
+			PixelCopier copy(sampler.source, writer);
+			for(int y = 0; y < dests[i].getHeight(); y++)
+				_copyRow(copy, dests[i].getData(Vec2i(0, y)), sampler.source.getData(Vec2i(0, y)), sampler.source.getPixelInc(), dests[i].getWidth());
+		}
+		else if(!_drawLossless(sampler, srcMapping, dests[i], targetMappings[i]))
+			firstTile[i + 1] += _tileCount(dests[i]);
+	}
+	parallelForStealing(firstTile[count], [&](int tile)
+	{
+		int i = (int)(std::upper_bound(firstTile.begin(), firstTile.end(), tile) - firstTile.begin()) - 1;
+		_drawTile(sampler, srcMapping, dests[i], targetMappings[i], method, tile - firstTile[i], tolerance);
+	});
+	return atlas;
+}
+
+//****** SAMPLER ******
+
+//NEAREST NEIGHBOUR
+template Surface pp::transform<NearestNeighbourSampler>(const NearestNeighbourSampler& source, TransformMapping& targetMapping, TransformMethod method, float tolerance);
+template Surface pp::transform<NearestNeighbourSampler>(const NearestNeighbourSampler& source, std::vector<TransformMapping>& targetMappings, TransformMethod method, std::vector<Area>& frames, float tolerance);
+
+NearestNeighbourSampler::NearestNeighbourSampler(Surface& src)
+{
+	source = src;
+}
+
+ColorA8u NearestNeighbourSampler::operator()(float x, float y) const
+{
+	Vec2i srcPxl;
+	srcPxl.x = (int)(x + 0.5);
+	srcPxl.y = (int)(y + 0.5);
+	return source.getPixel(srcPxl);
+}
+
+//ROTSPRITE
 
-//NEAREST NEIGHBOUR
-template Surface pp::transform<NearestNeighbourSampler>(NearestNeighbourSampler& source, TransformMapping& targetMapping, TransformMethod method);
+template Surface pp::transform<RotSpriteSampler>(const RotSpriteSampler& source, TransformMapping& targetMapping, TransformMethod method, float tolerance);
+template Surface pp::transform<RotSpriteSampler>(const RotSpriteSampler& source, std::vector<TransformMapping>& targetMappings, TransformMethod method, std::vector<Area>& frames, float tolerance);
 
-NearestNeighbourSampler::NearestNeighbourSampler(Surface& src)
+RotSpriteSampler::RotSpriteSampler(cinder::Surface& src)
 {
 	source = src;
 }
 
-ColorA8u NearestNeighbourSampler::operator()(float x, float y)
+/*
+One Scale2x step for the pixel in quadrant (qx, qy) of the window pixel at (x, y). Windows hold indices
+into the source pixels they stand for, colors are their packed colours.
+
+	  B
+	D E F -> E0 E1
+	  H      E2 E3
+*/
+inline uint8_t _scale2xAt(const uint8_t* window, int stride, const uint32_t* colors, int x, int y, int qx, int qy)
 {
-	Vec2i srcPxl;
-	srcPxl.x = (int)(x + 0.5);
-	srcPxl.y = (int)(y + 0.5);
-	return source.getPixel(srcPxl);
+	const uint8_t* e = window + y * stride + x;
+	uint32_t b = colors[e[-stride]];
+	uint32_t d = colors[e[-1]];
+	uint32_t f = colors[e[1]];
+	uint32_t h = colors[e[stride]];
+	if(b == h || d == f)
+		return *e;
+	uint32_t vertical = qy ? h : b;
+	if(qx == 0)
+		return (d == vertical) ? e[-1] : *e;
+	return (f == vertical) ? e[1] : *e;
+}
+
+ColorA8u RotSpriteSampler::operator()(float x, float y) const
+{
+	/*
+	The pixel at 8x is found by going up level by level (1x, 2x, 4x, 8x), each only as far as the windows
+	the next level needs: 3x3 pixels at 4x, 4x4 at 2x and 5x5 of the source. Coordinates are clamped at
+	every level like the line buffers of pp::scale do.
+	*/
+	int width = source.getWidth();
+	int height = source.getHeight();
+	int x3 = constrain((int)floor((x + 0.5f) * 8), 0, 8 * width - 1);
+	int y3 = constrain((int)floor((y + 0.5f) * 8), 0, 8 * height - 1);
+	int x2 = (x3 >> 1) - 1;
+	int y2 = (y3 >> 1) - 1;
+	int x1 = (x2 >> 1) - 1;
+	int y1 = (y2 >> 1) - 1;
+	int x0 = (x1 >> 1) - 1;
+	int y0 = (y1 >> 1) - 1;
+
+	Vec2i pixels[25];
+	uint32_t colors[25];
+	uint8_t level0[25];
+	int r = source.getRedOffset();
+	int g = source.getGreenOffset();
+	int b = source.getBlueOffset();
+	for(int j = 0; j < 5; j++)
+		for(int i = 0; i < 5; i++)
+		{
+			int k = j * 5 + i;
+			pixels[k] = Vec2i(constrain(x0 + i, 0, width - 1), constrain(y0 + j, 0, height - 1));
+			const uint8_t* p = source.getData(pixels[k]);
+			colors[k] = (p[r] << 16) | (p[g] << 8) | p[b];
+			level0[k] = (uint8_t)k;
+		}
+
+	uint8_t level1[16];
+	for(int j = 0; j < 4; j++)
+		for(int i = 0; i < 4; i++)
+		{
+			int cx = constrain(x1 + i, 0, 2 * width - 1);
+			int cy = constrain(y1 + j, 0, 2 * height - 1);
+			level1[j * 4 + i] = _scale2xAt(level0, 5, colors, (cx >> 1) - x0, (cy >> 1) - y0, cx & 1, cy & 1);
+		}
+
+	uint8_t level2[9];
+	for(int j = 0; j < 3; j++)
+		for(int i = 0; i < 3; i++)
+		{
+			int cx = constrain(x2 + i, 0, 4 * width - 1);
+			int cy = constrain(y2 + j, 0, 4 * height - 1);
+			level2[j * 3 + i] = _scale2xAt(level1, 4, colors, (cx >> 1) - x1, (cy >> 1) - y1, cx & 1, cy & 1);
+		}
+
+	return source.getPixel(pixels[_scale2xAt(level2, 3, colors, 1, 1, x3 & 1, y3 & 1)]);
 }
 
 //BILINEAR
 
-template Surface pp::transform<BilinearSampler>(BilinearSampler& source, TransformMapping& targetMapping, TransformMethod method);
+template Surface pp::transform<BilinearSampler>(const BilinearSampler& source, TransformMapping& targetMapping, TransformMethod method, float tolerance);
+template Surface pp::transform<BilinearSampler>(const BilinearSampler& source, std::vector<TransformMapping>& targetMappings, TransformMethod method, std::vector<Area>& frames, float tolerance);
 
 BilinearSampler::BilinearSampler(cinder::Surface& src)
 {
 	source = src;
 }
 
-ColorA8u BilinearSampler::operator()(float x, float y)
+ColorA8u BilinearSampler::operator()(float x, float y) const
+{
+	ColorA8u result;
+	sample(&x, &y, 1, &result);
+	return result;
+}
+
+void BilinearSampler::sample(const float* xs, const float* ys, int count, ColorA8u* out) const
 {
 	/*
 		a b
 		c d
+
+	In fixed point with 7 bits per axis, so the four weights add up to 1 << 14 and a channel times its
+	weight fits 32 bits. The neighbours are clamped to the source like getPixel does.
 	*/
-	int x1 = floor(x);
-	int y1 = floor(y);
-	int x2 = ceil(x);
-	int y2 = ceil(y);
-	ColorAf a = source.getPixel(Vec2i(x1, y1));
-	ColorAf b = source.getPixel(Vec2i(x2, y1));
-	ColorAf c = source.getPixel(Vec2i(x1, y2));
-	ColorAf d = source.getPixel(Vec2i(x2, y2));
-	float subx = x - x1;
-	float suby = y - y1;
-	return a*( (1-subx)	* (1-suby) )
-		 + b*( subx		* (1-suby) )
-		 + c*( (1-subx)	* suby )
-		 + d*( subx		* suby );
+	int width = source.getWidth();
+	int height = source.getHeight();
+	int inc = source.getPixelInc();
+	int rowBytes = source.getRowBytes();
+	int offsets[4] = { source.getRedOffset(), source.getGreenOffset(), source.getBlueOffset(), source.getAlphaOffset() };
+	bool alpha = offsets[3] >= 0;
+	const uint8_t* data = source.getData();
+	for(int i = 0; i < count; i++)
+	{
+		float fx = floor(xs[i]);
+		float fy = floor(ys[i]);
+		int wx = (int)((xs[i] - fx) * 128 + 0.5f);
+		int wy = (int)((ys[i] - fy) * 128 + 0.5f);
+		int x1 = constrain((int)fx, 0, width - 1);
+		int y1 = constrain((int)fy, 0, height - 1);
+		int x2 = constrain((int)fx + 1, 0, width - 1);
+		int y2 = constrain((int)fy + 1, 0, height - 1);
+		const uint8_t* a = data + y1 * rowBytes + x1 * inc;
+		const uint8_t* b = data + y1 * rowBytes + x2 * inc;
+		const uint8_t* c = data + y2 * rowBytes + x1 * inc;
+		const uint8_t* d = data + y2 * rowBytes + x2 * inc;
+		int wa = (128 - wx) * (128 - wy);
+		int wb = wx * (128 - wy);
+		int wc = (128 - wx) * wy;
+		int wd = wx * wy;
+		uint8_t mixed[4];
+#ifdef PP_SSE2
+		if(inc == 4)
+		{
+			//all four channels at once, pmaddwd sums the products of a and b (c and d) per channel
+			__m128i zero = _mm_setzero_si128();
+			__m128i ab = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int*)a), _mm_cvtsi32_si128(*(const int*)b)), zero);
+			__m128i cd = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int*)c), _mm_cvtsi32_si128(*(const int*)d)), zero);
+			__m128i sum = _mm_add_epi32(_mm_madd_epi16(ab, _mm_set1_epi32(wa | (wb << 16))), _mm_madd_epi16(cd, _mm_set1_epi32(wc | (wd << 16))));
+			sum = _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << 13)), 14);
+			sum = _mm_packs_epi32(sum, sum);
+			*(int*)mixed = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+		}
+		else
+#endif
+		for(int k = 0; k < inc; k++)
+			mixed[k] = (uint8_t)((a[k] * wa + b[k] * wb + c[k] * wc + d[k] * wd + (1 << 13)) >> 14);
+		out[i] = ColorA8u(mixed[offsets[0]], mixed[offsets[1]], mixed[offsets[2]], alpha ? mixed[offsets[3]] : 255);
+	}
 }
 
-template Surface pp::transform<BicubicSampler>(BicubicSampler& source, TransformMapping& targetMapping, TransformMethod method);
+template Surface pp::transform<BicubicSampler>(const BicubicSampler& source, TransformMapping& targetMapping, TransformMethod method, float tolerance);
+template Surface pp::transform<BicubicSampler>(const BicubicSampler& source, std::vector<TransformMapping>& targetMappings, TransformMethod method, std::vector<Area>& frames, float tolerance);
+
+//Catmull-Rom weights of the 4 pixels around a sub-pixel position t, for each of the BICUBIC_PHASES + 1 steps from 0 to 1
+struct BicubicWeights
+{
+	BicubicWeights()
+	{
+		for(int i = 0; i <= BICUBIC_PHASES; i++)
+		{
+			float t = i / (float)BICUBIC_PHASES;
+			w[i][0] = 0.5f * (-t + 2*t*t - t*t*t);
+			w[i][1] = 1 + 0.5f * (-5*t*t + 3*t*t*t);
+			w[i][2] = 0.5f * (t + 4*t*t - 3*t*t*t);
+			w[i][3] = 0.5f * (-t*t + t*t*t);
+		}
+	}
+	float w[BICUBIC_PHASES + 1][4];
+};
+
+const BicubicWeights BICUBIC_WEIGHTS;
 
-double _cubicInterpolate (double p[4], double x) 
+//RGBA copy of the source with the edges repeated BICUBIC_BORDER times so the 4x4 window hardly ever needs clamping
+Surface _padSource(const Surface& source)
 {
-	return p[1] + 0.5 * x*(p[2] - p[0] + x*(2.0*p[0] - 5.0*p[1] + 4.0*p[2] - p[3] + x*(3.0*(p[1] - p[2]) + p[3] - p[0])));
+	int width = source.getWidth();
+	int height = source.getHeight();
+	Surface padded(width + 2 * BICUBIC_BORDER, height + 2 * BICUBIC_BORDER, true, SurfaceChannelOrder::RGBA);
+	int inc = source.getPixelInc();
+	int r = source.getRedOffset();
+	int g = source.getGreenOffset();
+	int b = source.getBlueOffset();
+	int a = source.getAlphaOffset();
+	for(int y = 0; y < padded.getHeight(); y++)
+	{
+		const uint8_t* row = source.getData() + constrain(y - BICUBIC_BORDER, 0, height - 1) * source.getRowBytes();
+		uint8_t* dest = padded.getData() + y * padded.getRowBytes();
+		for(int x = 0; x < padded.getWidth(); x++, dest += 4)
+		{
+			const uint8_t* pixel = row + constrain(x - BICUBIC_BORDER, 0, width - 1) * inc;
+			dest[0] = pixel[r];
+			dest[1] = pixel[g];
+			dest[2] = pixel[b];
+			dest[3] = (a >= 0) ? pixel[a] : 255;
+		}
+	}
+	return padded;
 }
 
-double _bicubicInterpolate (double p[4][4], double x, double y) 
+//the 4x4 pixels around x, y in a padded source
+struct BicubicWindow
+{
+	BicubicWindow(const Surface& padded, float x, float y)
+	{
+		float fx = floor(x);
+		float fy = floor(y);
+		wx = BICUBIC_WEIGHTS.w[(int)((x - fx) * BICUBIC_PHASES + 0.5f)];
+		wy = BICUBIC_WEIGHTS.w[(int)((y - fy) * BICUBIC_PHASES + 0.5f)];
+		int x1 = (int)fx - 1 + BICUBIC_BORDER;
+		int y1 = (int)fy - 1 + BICUBIC_BORDER;
+		int width = padded.getWidth();
+		int height = padded.getHeight();
+		contiguous = x1 >= 0 && x1 + 4 <= width;
+		for(int i = 0; i < 4; i++)
+		{
+			//only positions outside of the border need to be clamped
+			cols[i] = 4 * (contiguous ? x1 + i : constrain(x1 + i, 0, width - 1));
+			rows[i] = padded.getData() + constrain(y1 + i, 0, height - 1) * padded.getRowBytes();
+		}
+	}
+	//channel c of the pixel at column i, row j of the window
+	uint8_t at(int i, int j, int c) const { return rows[j][cols[i] + c]; }
+	ColorA8u color(int i, int j) const { const uint8_t* p = rows[j] + cols[i]; return ColorA8u(p[0], p[1], p[2], p[3]); }
+	const uint8_t* rows[4];
+	int cols[4];
+	bool contiguous;
+	const float* wx;
+	const float* wy;
+};
+
+//interpolates all 4 channels of the window, separably, in the range 0..255
+void _bicubicInterpolate(const BicubicWindow& window, float rgba[4])
 {
-	double arr[4];
-	arr[0] = _cubicInterpolate(p[0], y);
-	arr[1] = _cubicInterpolate(p[1], y);
-	arr[2] = _cubicInterpolate(p[2], y);
-	arr[3] = _cubicInterpolate(p[3], y);
-	return constrain(_cubicInterpolate(arr, x), 0.0, 1.0);
+#ifdef PP_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128 sum = _mm_setzero_ps();
+	for(int j = 0; j < 4; j++)
+	{
+		const uint8_t* row = window.rows[j];
+		__m128i pixels = window.contiguous ? _mm_loadu_si128((const __m128i*)(row + window.cols[0])) : 
+			_mm_setr_epi32(*(const int*)(row + window.cols[0]), *(const int*)(row + window.cols[1]), *(const int*)(row + window.cols[2]), *(const int*)(row + window.cols[3]));
+		__m128i lo = _mm_unpacklo_epi8(pixels, zero);
+		__m128i hi = _mm_unpackhi_epi8(pixels, zero);
+		__m128 mixed = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), _mm_set1_ps(window.wx[0]));
+		mixed = _mm_add_ps(mixed, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), _mm_set1_ps(window.wx[1])));
+		mixed = _mm_add_ps(mixed, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), _mm_set1_ps(window.wx[2])));
+		mixed = _mm_add_ps(mixed, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), _mm_set1_ps(window.wx[3])));
+		sum = _mm_add_ps(sum, _mm_mul_ps(mixed, _mm_set1_ps(window.wy[j])));
+	}
+	sum = _mm_min_ps(_mm_max_ps(sum, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+	_mm_storeu_ps(rgba, sum);
+#else
+	for(int c = 0; c < 4; c++)
+	{
+		float sum = 0;
+		for(int j = 0; j < 4; j++)
+		{
+			float mixed = 0;
+			for(int i = 0; i < 4; i++)
+				mixed += window.at(i, j, c) * window.wx[i];
+			sum += mixed * window.wy[j];
+		}
+		rgba[c] = constrain(sum, 0.0f, 255.0f);
+	}
+#endif
 }
 
 BicubicSampler::BicubicSampler(cinder::Surface& src)
 {
 	source = src;
+	padded = _padSource(src);
 }
 
-ci::ColorA8u BicubicSampler::operator()(float x, float y)
+ci::ColorA8u BicubicSampler::operator()(float x, float y) const
 {
-	/*
-		4x4		
-	*/
-	int x1 = floor(x)-1;
-	int y1 = floor(y)-1;
-	double p[3][4][4];
-	for(int ox = 0; ox < 4; ox++)
-		for(int oy = 0; oy < 4; oy++)
-		{
-			ColorAf c = source.getPixel(Vec2i(x1+ox, y1+oy));
-			p[0][ox][oy] = c.r;
-			p[1][ox][oy] = c.g;
-			p[2][ox][oy] = c.b;
-		}
-	
-	float subx = x - floor(x);
-	float suby = y - floor(y);
-	ColorA8u result(0,0,0,1);
-	result.r = 255*_bicubicInterpolate(p[0],subx,suby);
-	result.g = 255*_bicubicInterpolate(p[1],subx,suby);
-	result.b = 255*_bicubicInterpolate(p[2],subx,suby);
+	ColorA8u result;
+	sample(&x, &y, 1, &result);
 	return result;
 }
 
-template Surface pp::transform<BilinearDominanceSampler>(BilinearDominanceSampler& source, TransformMapping& targetMapping, TransformMethod method);
-
-BilinearDominanceSampler::BilinearDominanceSampler(cinder::Surface& src, int sampleOrder)
+void BicubicSampler::sample(const float* xs, const float* ys, int count, ci::ColorA8u* out) const
 {
-	source = src;
-	order = sampleOrder;
+	for(int i = 0; i < count; i++)
+	{
+		float rgba[4];
+		_bicubicInterpolate(BicubicWindow(padded, xs[i], ys[i]), rgba);
+		out[i] = ColorA8u((uint8_t)(rgba[0] + 0.5f), (uint8_t)(rgba[1] + 0.5f), (uint8_t)(rgba[2] + 0.5f), 1);
+	}
 }
 
-ColorA8u BilinearDominanceSampler::operator()(float x, float y)
+/*
+The distinct colors of the 2x2 pixels around a position and how much of it each covers, returns how many there are
+	a b
+	c d
+*/
+int _bilinearColors(const ColorA8u& a, const ColorA8u& b, const ColorA8u& c, const ColorA8u& d, float subx, float suby, ColorA8u colors[4], float weights[4])
 {
-	/*
-		a b
-		c d
-	*/
 	int i = 0;
 	int k = 0;
-	ColorA8u colors[4];
-	float weights[4];
-	int x1 = floor(x);
-	int y1 = floor(y);
-	int x2 = ceil(x);
-	int y2 = ceil(y);
-	float subx = x - x1;
-	float suby = y - y1;
 	//A
-	colors[i] = source.getPixel(Vec2i(x1, y1));
+	colors[i] = a;
 	weights[i] =  (1-subx)	* (1-suby);
 	i++;
 	//B
-	ColorA8u c = source.getPixel(Vec2i(x2, y1));
 	for(k = 0; k < i; k++)
-		if(colors[k].r == c.r && colors[k].g == c.g && colors[k].b == c.b)
+		if(colors[k].r == b.r && colors[k].g == b.g && colors[k].b == b.b)
 		{
 			weights[k] += subx * (1-suby);
 			break;
 		}
 	if(k == i)
 	{
-		colors[i] = c;
+		colors[i] = b;
 		weights[i] = subx * (1-suby);
 		i++;
 	}
 	//C
-	c = source.getPixel(Vec2i(x1, y2));
 	for(k = 0; k < i; k++)
 		if(colors[k].r == c.r && colors[k].g == c.g && colors[k].b == c.b)
 		{
@@ -342,45 +1445,47 @@ ColorA8u BilinearDominanceSampler::operator()(float x, float y)
 		i++;
 	}
 	//D
-	c = source.getPixel(Vec2i(x2, y2));
 	for(k = 0; k < i; k++)
-		if(colors[k].r == c.r && colors[k].g == c.g && colors[k].b == c.b)
+		if(colors[k].r == d.r && colors[k].g == d.g && colors[k].b == d.b)
 		{
 			weights[k] += (1-subx) * suby;
 			break;
 		}
 	if(k == i)
 	{
-		colors[i] = c;
+		colors[i] = d;
 		weights[i] = subx * suby;
 		i++;
 	}
-	/**
-	int best = 0;
-	for(k = 0; k < i; k++)
-	{
-		if(weights[k] >= weights[best])
-			best = k;
-	}
-	return colors[best];
-	**/
-	if(i == 1)
-		return colors[0];
+	return i;
+}
+
+int _bilinearColors(const Surface& source, float x, float y, ColorA8u colors[4], float weights[4])
+{
+	int x1 = floor(x);
+	int y1 = floor(y);
+	int x2 = ceil(x);
+	int y2 = ceil(y);
+	float subx = x - x1;
+	float suby = y - y1;
+	return _bilinearColors(source.getPixel(Vec2i(x1, y1)), source.getPixel(Vec2i(x2, y1)), source.getPixel(Vec2i(x1, y2)), source.getPixel(Vec2i(x2, y2)), subx, suby, colors, weights);
+}
 
-	//make sure that 
-	int max = 0;
+//index of the order-th most dominant of count colors, the entries of the more dominant ones are overwritten
+int _dominant(ColorA8u colors[4], float weights[4], int count, int order)
+{
 	int a = -1;
 	while(true)
 	{
 		//assume [a] is max
 		int max = ++a;
 		//find the real max
-		for(k = max + 1; k < i; k++)
+		for(int k = max + 1; k < count; k++)
 			if(weights[k] > weights[max])
 				max = k; //new max
 		
 		if(a == order)
-			return colors[max];
+			return max;
 		//if we're not done and colors[a] is not max it might still be our result 
 		//so we replace colors[max] (which we don't care for) with colors[a]
 		if(max != a)
@@ -389,63 +1494,71 @@ ColorA8u BilinearDominanceSampler::operator()(float x, float y)
 			colors[max] = colors[a];
 		}
 	}
-	return colors[max];
 }
 
-template Surface pp::transform<BicubicBestFitSampler>(BicubicBestFitSampler& source, TransformMapping& targetMapping, TransformMethod method);
+template Surface pp::transform<BilinearDominanceSampler>(const BilinearDominanceSampler& source, TransformMapping& targetMapping, TransformMethod method, float tolerance);
+template Surface pp::transform<BilinearDominanceSampler>(const BilinearDominanceSampler& source, std::vector<TransformMapping>& targetMappings, TransformMethod method, std::vector<Area>& frames, float tolerance);
+
+BilinearDominanceSampler::BilinearDominanceSampler(cinder::Surface& src, int sampleOrder)
+{
+	source = src;
+	order = sampleOrder;
+}
+
+ColorA8u BilinearDominanceSampler::operator()(float x, float y) const
+{
+	ColorA8u colors[4];
+	float weights[4];
+	int i = _bilinearColors(source, x, y, colors, weights);
+	/**
+	int best = 0;
+	for(k = 0; k < i; k++)
+	{
+		if(weights[k] >= weights[best])
+			best = k;
+	}
+	return colors[best];
+	**/
+	if(i == 1)
+		return colors[0];
+
+	return colors[_dominant(colors, weights, i, order)];
+}
+
+template Surface pp::transform<BicubicBestFitSampler>(const BicubicBestFitSampler& source, TransformMapping& targetMapping, TransformMethod method, float tolerance);
+template Surface pp::transform<BicubicBestFitSampler>(const BicubicBestFitSampler& source, std::vector<TransformMapping>& targetMappings, TransformMethod method, std::vector<Area>& frames, float tolerance);
 
 BicubicBestFitSampler::BicubicBestFitSampler(cinder::Surface& src, bool allowOuterPixels) : palette(NULL)
 {
 	source = src;
+	padded = _padSource(src);
 	mode = allowOuterPixels ? LOCAL_4x4 : LOCAL_2x2;
 }
 
-BicubicBestFitSampler::BicubicBestFitSampler(cinder::Surface& src, Palette& colors) : palette(&colors)
+BicubicBestFitSampler::BicubicBestFitSampler(cinder::Surface& src, Palette& colors) : palette(&colors), paletteIndex(new PaletteIndex(colors))
 {
 	source = src;
+	padded = _padSource(src);
 	mode = PALETTE;
 }
 
-ci::ColorA8u BicubicBestFitSampler::operator()(float x, float y)
+ci::ColorA8u BicubicBestFitSampler::operator()(float x, float y) const
 {
-	/*
-		4x4		
-	*/
-	int x1 = floor(x)-1;
-	int y1 = floor(y)-1;
-	double p[3][4][4];
-	for(int ox = 0; ox < 4; ox++)
-		for(int oy = 0; oy < 4; oy++)
-		{
-			ColorAf c = source.getPixel(Vec2i(x1+ox, y1+oy));
-			p[0][ox][oy] = c.r;
-			p[1][ox][oy] = c.g;
-			p[2][ox][oy] = c.b;
-		}
-	
-	float subx = x - floor(x);
-	float suby = y - floor(y);
-	float r = _bicubicInterpolate(p[0],subx,suby);
-	float g = _bicubicInterpolate(p[1],subx,suby);
-	float b = _bicubicInterpolate(p[2],subx,suby);
+	BicubicWindow window(padded, x, y);
+	float rgba[4];
+	_bicubicInterpolate(window, rgba);
+	float r = rgba[0] / 255.0f;
+	float g = rgba[1] / 255.0f;
+	float b = rgba[2] / 255.0f;
 
 	//return the best fitting of the 4 center pixels (least squares)
 	ColorA8u result(0,0,0,1);
 	float best = std::numeric_limits<float>::max();
 	if(mode == PALETTE && palette)
 	{
-		ColorA8u pxl(255 * r, 255 * g, 255 * b);
-		for(Palette::iterator it = palette->begin(); it != palette->end(); it++)
-		{
-			float error = it->distanceSquared(pxl);
-			if(error < best)//found
-			{
-				result = *it;
-				best = error;
-			}
-			if(error == 0)
-				break;
-		}
+		int nearest = paletteIndex->nearest(Color8u(255 * r, 255 * g, 255 * b));
+		if(nearest >= 0)
+			result = paletteIndex->color(nearest);
 	}
 	else
 	{
@@ -454,9 +1567,9 @@ ci::ColorA8u BicubicBestFitSampler::operator()(float x, float y)
 		for(int i = from; i <= to; i++)
 			for(int j = from; j <= to; j++)
 			{
-				float r_ij = p[0][i][j];
-				float g_ij = p[1][i][j];
-				float b_ij = p[2][i][j];
+				float r_ij = window.at(i, j, 0) / 255.0f;
+				float g_ij = window.at(i, j, 1) / 255.0f;
+				float b_ij = window.at(i, j, 2) / 255.0f;
 				float error = (r_ij-r)*(r_ij-r) + (g_ij-g)*(g_ij-g) + (b_ij-b)*(b_ij-b);
 				if(error < best)
 				{
@@ -474,7 +1587,8 @@ ci::ColorA8u BicubicBestFitSampler::operator()(float x, float y)
 //***
 //***
 
-template Surface pp::transform<WeightSampler>(WeightSampler& source, TransformMapping& targetMapping, TransformMethod method);
+template Surface pp::transform<WeightSampler>(const WeightSampler& source, TransformMapping& targetMapping, TransformMethod method, float tolerance);
+template Surface pp::transform<WeightSampler>(const WeightSampler& source, std::vector<TransformMapping>& targetMappings, TransformMethod method, std::vector<Area>& frames, float tolerance);
 
 WeightSampler::WeightSampler(cinder::Surface& src, int sampleOrder)
 {
@@ -482,94 +1596,208 @@ WeightSampler::WeightSampler(cinder::Surface& src, int sampleOrder)
 	order = sampleOrder;
 }
 
-ColorA8u WeightSampler::operator()(float x, float y)
+ColorA8u WeightSampler::operator()(float x, float y) const
 {
-	/*
-		a b
-		c d
-	*/
-	int i = 0;
-	int k = 0;
 	ColorA8u colors[4];
 	float weights[4];
+	int i = _bilinearColors(source, x, y, colors, weights);
+
+	if(i < (order+1))//order doesn't exists
+		return ColorA8u(0,0,0);
+
+	if(i == 1 && order == 0)//only one value
+		return ColorA8u(255,0,0);
+
+	return ColorA8u(weights[_dominant(colors, weights, i, order)]*255,0,0);
+}
+
+//BILINEAR MIX
+BilinearMixSampler::BilinearMixSampler(cinder::Surface& src)
+{
+	source = src;
+	padded = _padSource(src);
+}
+
+BilinearMixSampler::Sample BilinearMixSampler::operator()(float x, float y) const
+{
+	Sample result;
+	BicubicWindow window(padded, x, y);
+	float rgba[4];
+	_bicubicInterpolate(window, rgba);
+	result.bicubic = ColorA8u((uint8_t)(rgba[0] + 0.5f), (uint8_t)(rgba[1] + 0.5f), (uint8_t)(rgba[2] + 0.5f), 1);
+
+	//the 2x2 pixels are in the middle of the window, at whole coordinates the right or bottom ones are the left or top ones again
 	int x1 = floor(x);
 	int y1 = floor(y);
-	int x2 = ceil(x);
-	int y2 = ceil(y);
 	float subx = x - x1;
 	float suby = y - y1;
-	//A
-	colors[i] = source.getPixel(Vec2i(x1, y1));
-	weights[i] =  (1-subx)	* (1-suby);
-	i++;
-	//B
-	ColorA8u c = source.getPixel(Vec2i(x2, y1));
-	for(k = 0; k < i; k++)
-		if(colors[k].r == c.r && colors[k].g == c.g && colors[k].b == c.b)
-		{
-			weights[k] += subx * (1-suby);
-			break;
-		}
-	if(k == i)
+	int i2 = (subx > 0) ? 2 : 1;
+	int j2 = (suby > 0) ? 2 : 1;
+	ColorA8u colors[4];
+	float weights[4];
+	int count = _bilinearColors(window.color(1, 1), window.color(i2, 1), window.color(1, j2), window.color(i2, j2), subx, suby, colors, weights);
+	result.first = colors[_dominant(colors, weights, count, 0)];
+	result.second = result.first;
+	result.secondWeight = 0;
+	if(count > 1)
 	{
-		colors[i] = c;
-		weights[i] = subx * (1-suby);
-		i++;
+		int second = _dominant(colors, weights, count, 1);
+		result.second = colors[second];
+		result.secondWeight = weights[second]*255;
 	}
-	//C
-	c = source.getPixel(Vec2i(x1, y2));
-	for(k = 0; k < i; k++)
-		if(colors[k].r == c.r && colors[k].g == c.g && colors[k].b == c.b)
-		{
-			weights[k] += (1-subx) * suby;
-			break;
-		}
-	if(k == i)
+	return result;
+}
+
+/*
+What the first pass of a mix draws: the engine draws the first colors into a surface and each sample's second color
+(with its weight as alpha) and (bicubic - first) / 255 per channel, the difference compare blurs, go to the planes
+next to it.
+*/
+struct MixPass
+{
+	MixPass(const BilinearMixSampler& mixSampler, Surface& firstColors, Surface& secondColors, std::vector<float>& differences)
+	:	sampler(mixSampler),
+		source(mixSampler.source),
+		first(firstColors.getData()),
+		rowBytes(firstColors.getRowBytes()),
+		width(firstColors.getWidth()),
+		second(secondColors),
+		diffs(differences)
 	{
-		colors[i] = c;
-		weights[i] = (1-subx) * suby;
-		i++;
 	}
-	//D
-	c = source.getPixel(Vec2i(x2, y2));
-	for(k = 0; k < i; k++)
-		if(colors[k].r == c.r && colors[k].g == c.g && colors[k].b == c.b)
-		{
-			weights[k] += (1-subx) * suby;
-			break;
-		}
-	if(k == i)
+
+	const BilinearMixSampler& sampler;
+	Surface source;
+	const uint8_t* first;
+	int rowBytes;
+	int width;
+	Surface& second;
+	std::vector<float>& diffs;
+};
+
+void _drawSamples(const MixPass& pass, const PixelWriter& writer, uint8_t* pixel, const float* xs, const float* ys, int count)
+{
+	int offset = (int)(pixel - pass.first);
+	int y = offset / pass.rowBytes;
+	int x = (offset - y * pass.rowBytes) / writer.inc;
+	uint8_t* second = pass.second.getData(Vec2i(x, y));
+	float* diff = &pass.diffs[3 * (y * pass.width + x)];
+	for(int i = 0; i < count; i++, pixel += writer.inc, second += writer.inc, diff += 3)
 	{
-		colors[i] = c;
-		weights[i] = subx * suby;
-		i++;
+		BilinearMixSampler::Sample sample = pass.sampler(xs[i], ys[i]);
+		writer.set(pixel, sample.first);
+		writer.set(second, ColorA8u(sample.second.r, sample.second.g, sample.second.b, sample.secondWeight));
+		diff[0] = (sample.bicubic.r - sample.first.r) / 255.0f;
+		diff[1] = (sample.bicubic.g - sample.first.g) / 255.0f;
+		diff[2] = (sample.bicubic.b - sample.first.b) / 255.0f;
 	}
+}
 
-	if(i < (order+1))//order doesn't exists
-		return ColorA8u(0,0,0);
-
-	if(i == 1 && order == 0)//only one value
-		return ColorA8u(255,0,0);
+//the first colors are the source pixels there, like BilinearDominanceSampler's, and so are the second ones
+bool _copiesPixels(const MixPass& pass)
+{
+	return true;
+}
 
+/*
+The second pass of a mix: compare's blur of the differences, then choose's pick of the second color where that error
+is a local maximum and large enough for the second's weight. Its kernel weights are powers of two, so multiplying
+the differences already divided by 255 gives the same floats as compare.
+*/
+Surface _chooseMix(Surface& first, Surface& second, const std::vector<float>& diffs, float threshold)
+{
+	const float kernel[3][3] = {{0.0625,0.125,0.0625},{0.125,0.25,0.125},{0.0625,0.125,0.0625}};
+	int width = first.getWidth();
+	int height = first.getHeight();
+	std::vector<int> errors(width * height);
+	parallelFor(height, [&](int y)
+	{
+		//the rows above and below, repeated at the edges
+		const float* rows[3];
+		for(int j = 0; j < 3; j++)
+			rows[j] = &diffs[3 * width * constrain(y + j - 1, 0, height - 1)];
+		int* error = &errors[y * width];
+		for(int x = 0; x < width; x++)
+		{
+			int columns[3] = { 3 * std::max(x - 1, 0), 3 * x, 3 * std::min(x + 1, width - 1) };
+			int c[4];
+#ifdef PP_SSE2
+			//the channels side by side, the fourth lane is the next pixel's red and ignored
+			__m128 sum = _mm_set1_ps(0.5f);
+			for(int i = 0; i < 3; i++)
+				for(int j = 0; j < 3; j++)
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(kernel[i][j]), _mm_loadu_ps(rows[j] + columns[i])));
+			_mm_storeu_si128((__m128i*)c, _mm_cvttps_epi32(_mm_mul_ps(sum, _mm_set1_ps(255.0f))));
+#else
+			float sum[3] = {0.5,0.5,0.5};
+			for(int i = 0; i < 3; i++)
+				for(int j = 0; j < 3; j++)
+				{
+					const float* d = rows[j] + columns[i];
+					for(int k = 0; k < 3; k++)
+						sum[k] += kernel[i][j] * d[k];
+				}
+			for(int k = 0; k < 3; k++)
+				c[k] = (int)(sum[k]*255);
+#endif
+			//squared distance of the error color from grey, out of range colors wrap around like compare's
+			error[x] = 0;
+			for(int k = 0; k < 3; k++)
+			{
+				int e = (uint8_t)c[k] - 127;
+				error[x] += e * e;
+			}
+		}
+	});
 
-	//make sure that 
-	int max = 0;
-	int a = -1;
-	while(true)
+	Surface result(width, height, false);
+	parallelFor(height, [&](int y)
 	{
-		//assume [a] is max
-		int max = ++a;
-		//find the real max
-		for(k = max + 1; k < i; k++)
-			if(weights[k] > weights[max])
-				max = k; //new max
-		
-		if(a == order)
-			return ColorA8u(weights[max]*255,0,0);
-		//if we're not done and colors[a] is not max it might still be our result 
-		//so we replace colors[max] (which we don't care for) with colors[a]
-		if(max != a)
-			weights[max] = weights[a];
-	}
-	return ColorA8u(0,255,0);
+		PixelWriter writer(result);
+		uint8_t* pixel = result.getData(Vec2i(0, y));
+		const int* rows[3];
+		for(int j = 0; j < 3; j++)
+			rows[j] = &errors[width * constrain(y + j - 1, 0, height - 1)];
+		//both planes are RGBA, the weight of the second color is its alpha
+		const uint8_t* firstColor = first.getData(Vec2i(0, y));
+		const uint8_t* secondColor = second.getData(Vec2i(0, y));
+		for(int x = 0; x < width; x++, pixel += writer.inc, firstColor += 4, secondColor += 4)
+		{
+			//is the error a local maximum?
+			float errA = rows[1][x];
+			bool swap = !(std::sqrt(errA)*secondColor[3] <= threshold*(3*127*127));
+			int columns[3] = { std::max(x - 1, 0), x, std::min(x + 1, width - 1) };
+			for(int i = 0; i < 3 && swap; i++)
+				for(int j = 0; j < 3 && swap; j++)
+					if((i != 1 || j != 1) && rows[j][columns[i]] >= errA)
+						swap = false;
+			const uint8_t* chosen = swap ? secondColor : firstColor;
+			writer.set(pixel, ColorA8u(chosen[0], chosen[1], chosen[2]));
+		}
+	});
+	return result;
+}
+
+Surface pp::mix(const BilinearMixSampler& sampler, TransformMapping& targetMapping, TransformMethod method, float threshold, float tolerance)
+{
+	if(method == TM_IDENTITY)
+		return sampler.source;
+
+	Surface first(targetMapping.bounds.getWidth(), targetMapping.bounds.getHeight(), true, SurfaceChannelOrder::RGBA);
+	Surface second(first.getWidth(), first.getHeight(), true, SurfaceChannelOrder::RGBA);
+	//blank target pixels are only cleared in first, in the others they have to start out that way
+	//(one more difference so the last pixel's can be read 4 at a time)
+	std::vector<float> diffs(3 * first.getWidth() * first.getHeight() + 1, 0.0f);
+	for(int y = 0; y < second.getHeight(); y++)
+		memset(second.getData(Vec2i(0, y)), 0, second.getWidth() * second.getPixelInc());
+
+	MixPass pass(sampler, first, second, diffs);
+	TransformMapping srcMapping(sampler.source.getBounds());
+	//copied pixels leave nothing to choose from, the second plane has no weight
+	if(!_drawLossless(pass, srcMapping, first, targetMapping))
+		parallelForStealing(_tileCount(first), [&](int i)
+		{
+			_drawTile(pass, srcMapping, first, targetMapping, method, i, tolerance);
+		});
+	return _chooseMix(first, second, diffs, threshold);
 }
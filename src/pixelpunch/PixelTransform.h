@@ -3,6 +3,9 @@
 #include "cinder/Cinder.h"
 #include "cinder/Surface.h"
 #include "cinder/Rect.h"
+#include "PaletteIndex.h"
+#include <memory>
+#include <vector>
 
 namespace pp 
 {
@@ -17,6 +20,8 @@ namespace pp
 	{
 		TransformMapping(cinder::Vec2f* pts);
 		TransformMapping(const cinder::Rectf& rect);
+		//rect rotated around its center, angle in radians
+		TransformMapping(const cinder::Rectf& rect, float angle);
 		ci::Vec2f localQuad[4]; //starting with TOPLEFT clockwise, local to bounds
 		ci::Rectf bounds;
 	};
@@ -32,7 +37,8 @@ namespace pp
 		SAMPLE_BEST_FIT_ANY,
 		SAMPLE_FIRST_WEIGHT,
 		SAMPLE_SECOND_WEIGHT,
-		SAMPLE_MINIMIZE_ERROR
+		SAMPLE_MINIMIZE_ERROR,
+		SAMPLE_ROTSPRITE
 	};
 	typedef enum SamplingMethod SamplingMethod;
 
@@ -40,21 +46,38 @@ namespace pp
 	{
 		NearestNeighbourSampler(cinder::Surface& src);
 		ci::Surface source;
-		ci::ColorA8u operator()(float x, float y);
+		ci::ColorA8u operator()(float x, float y) const;
+	};
+
+	/*
+	Nearest neighbour on the source scaled up 8x by applying Scale2x three times, which is how RotSprite
+	rotates pixel art. The scaled image is never built, each sample is worked out from the 5x5 source
+	pixels around it.
+	*/
+	struct RotSpriteSampler
+	{
+		RotSpriteSampler(cinder::Surface& src);
+		ci::Surface source;
+		ci::ColorA8u operator()(float x, float y) const;
 	};
 
 	struct BilinearSampler
 	{
 		BilinearSampler(cinder::Surface& src);
 		ci::Surface source;
-		ci::ColorA8u operator()(float x, float y);
+		ci::ColorA8u operator()(float x, float y) const;
+		//count samples at (xs[i], ys[i]) at once, with the same results as calling operator() for each
+		void sample(const float* xs, const float* ys, int count, ci::ColorA8u* out) const;
 	};
 
 	struct BicubicSampler
 	{
 		BicubicSampler(cinder::Surface& src);
 		ci::Surface source;
-		ci::ColorA8u operator()(float x, float y);
+		ci::Surface padded; //RGBA copy of source with a border of repeated edge pixels
+		ci::ColorA8u operator()(float x, float y) const;
+		//count samples at (xs[i], ys[i]) at once, with the same results as calling operator() for each
+		void sample(const float* xs, const float* ys, int count, ci::ColorA8u* out) const;
 	};
 	
 	struct BilinearDominanceSampler
@@ -62,7 +85,7 @@ namespace pp
 		BilinearDominanceSampler(cinder::Surface& src, int sampleOrder);
 		ci::Surface source;
 		int order; //0 = most dominant, 1 = 2nd most dominant...
-		ci::ColorA8u operator()(float x, float y);
+		ci::ColorA8u operator()(float x, float y) const;
 	};
 
 	struct BicubicBestFitSampler
@@ -72,9 +95,11 @@ namespace pp
 		BicubicBestFitSampler(cinder::Surface& src, bool allowOuterPixels);
 		BicubicBestFitSampler(cinder::Surface& src, Palette& colors);
 		ci::Surface source;
+		ci::Surface padded; //RGBA copy of source with a border of repeated edge pixels
 		ColorSelectMode mode;
 		Palette* palette;
-		ci::ColorA8u operator()(float x, float y);
+		std::shared_ptr<PaletteIndex> paletteIndex; //built from palette when the sampler is created
+		ci::ColorA8u operator()(float x, float y) const;
 	};
 
 	struct WeightSampler
@@ -82,12 +107,55 @@ namespace pp
 		WeightSampler(cinder::Surface& src, int sampleOrder);
 		ci::Surface source;
 		int order; //0 = most dominant, 1 = 2nd most dominant...
-		ci::ColorA8u operator()(float x, float y);
+		ci::ColorA8u operator()(float x, float y) const;
+	};
+
+	/*
+	All that SAMPLE_MINIMIZE_ERROR chooses from, out of the one 4x4 window around a position: the bicubic color and
+	the most and second most dominant of the 2x2 colors in its middle with the weight of the second. The same as what
+	BicubicSampler, BilinearDominanceSampler and WeightSampler (orders 0 and 1) return there.
+	*/
+	struct BilinearMixSampler
+	{
+		struct Sample
+		{
+			ci::ColorA8u bicubic;
+			ci::ColorA8u first;
+			ci::ColorA8u second;
+			uint8_t secondWeight;
+		};
+
+		BilinearMixSampler(cinder::Surface& src);
+		ci::Surface source;
+		ci::Surface padded; //RGBA copy of source with a border of repeated edge pixels
+		Sample operator()(float x, float y) const;
 	};
 
 
+	/*
+	With a tolerance > 0 projective and bilinear warps are drawn as a mesh of affine pieces that are stepped
+	through like an affine transform. No piece is off the exact source position by more than tolerance pixels
+	at the points it's checked at, 1/64 leaves nearest neighbour sampling practically unchanged.
+	Rotations by multiples of 90 degrees and mirrors of the source are copied pixel by pixel instead of
+	sampled if the sampler would return the source pixels unchanged anyway (nearest neighbour and dominance).
+	*/
 	template<class Sampler>
-	cinder::Surface transform(Sampler& source, TransformMapping& targetMapping, TransformMethod method);
+	cinder::Surface transform(const Sampler& source, TransformMapping& targetMapping, TransformMethod method, float tolerance = 0);
+
+	/*
+	Transforms the source into each of the target mappings and packs the results into a single atlas, frames[i]
+	is where result i ended up. All frames are drawn in one go on the thread pool and share the sampler (and
+	whatever it was set up with, like a palette), e.g. for a sprite pre-rotated at many angles.
+	*/
+	template<class Sampler>
+	cinder::Surface transform(const Sampler& source, std::vector<TransformMapping>& targetMappings, TransformMethod method, std::vector<cinder::Area>& frames, float tolerance = 0);
+
+	/*
+	SAMPLE_MINIMIZE_ERROR, the same as choose(first, second, compare(bicubic, first), secondWeight, threshold) on the
+	transforms of the samplers it combines, but each target pixel is mapped and sampled once. The candidates are
+	drawn in one pass and picked from in a second.
+	*/
+	cinder::Surface mix(const BilinearMixSampler& source, TransformMapping& targetMapping, TransformMethod method, float threshold, float tolerance = 0);
 
 
 }
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "Kernel.h"
+#include <vector>
+
+namespace pp
+{
+	/*
+	Lookup table for a scaling rule that only depends on which pixels of a 3x3 neighbourhood are equal.
+	The Rule describes itself with
+
+		enum { Comparisons = n, Outputs = m };
+		static const int pairs[Comparisons][2];                  //compared pixels, row-major indices into 3x3
+		static void sources(const bool* equal, uint8_t* sources);  //which of the 9 pixels feeds each output
+
+	and the table holds the result of sources() for every combination of comparison outcomes. It is filled
+	once when constructed, so a pixel is scaled by building its signature (one bit per comparison) and
+	looking up its outputs without any branches.
+	*/
+	template<class Rule>
+	class RuleTable
+	{
+	public:
+		RuleTable() : mSources((1 << Rule::Comparisons) * Rule::Outputs)
+		{
+			bool equal[Rule::Comparisons];
+			for(int signature = 0; signature < (1 << Rule::Comparisons); signature++)
+			{
+				for(int i = 0; i < Rule::Comparisons; i++)
+					equal[i] = ((signature >> i) & 1) != 0;
+				Rule::sources(equal, &mSources[signature * Rule::Outputs]);
+			}
+		}
+
+		//dst gets the outputs in row-major order
+		template<int W, int H, class P> 
+		void apply(const Kernel<3, 3, 1, 1, P>& src, Kernel<W, H, 0, 0, P>& dst) const
+		{
+			int signature = 0;
+			for(int i = 0; i < Rule::Comparisons; i++)
+				signature |= (src[Rule::pairs[i][0]] == src[Rule::pairs[i][1]]) << i;
+			const uint8_t* sources = &mSources[signature * Rule::Outputs];
+			for(int i = 0; i < Rule::Outputs; i++)
+				dst[i] = src[sources[i]];
+		}
+
+	private:
+		std::vector<uint8_t> mSources;
+	};
+}
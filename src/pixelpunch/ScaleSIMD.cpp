@@ -0,0 +1,226 @@
+#include "PixelPunch.h"
+#include "ScaleSIMD.h"
+#include <cstring>
+
+#ifdef PP_SSE2
+#include <emmintrin.h>
+
+//mask ? a : b
+inline __m128i _select(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+inline __m128i _notEqual(__m128i a, __m128i b)
+{
+	return _mm_xor_si128(_mm_cmpeq_epi32(a, b), _mm_set1_epi32(-1));
+}
+
+inline __m128i _notEqualBytes(__m128i a, __m128i b)
+{
+	return _mm_xor_si128(_mm_cmpeq_epi8(a, b), _mm_set1_epi32(-1));
+}
+
+//[a0 a1 a2 a3] [b0 b1 b2 b3] [c0 c1 c2 c3] -> [a0 b0 c0 a1] [b1 c1 a2 b2] [c2 a3 b3 c3]
+inline void _storeInterleaved3(uint32_t* dest, __m128i a, __m128i b, __m128i c)
+{
+	__m128 ab_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(a, b));
+	__m128 ab_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(a, b));
+	__m128 bc_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(b, c));
+	__m128 bc_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(b, c));
+	__m128 ca_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(c, a));
+	__m128 ca_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(c, a));
+	_mm_storeu_si128((__m128i*)(dest + 0), _mm_castps_si128(_mm_shuffle_ps(ab_lo, ca_lo, _MM_SHUFFLE(3,0,1,0))));
+	_mm_storeu_si128((__m128i*)(dest + 4), _mm_castps_si128(_mm_shuffle_ps(bc_lo, ab_hi, _MM_SHUFFLE(1,0,3,2))));
+	_mm_storeu_si128((__m128i*)(dest + 8), _mm_castps_si128(_mm_shuffle_ps(ca_hi, bc_hi, _MM_SHUFFLE(3,2,3,0))));
+}
+
+int pp::scale2xRowSIMD(const uint32_t* above, const uint32_t* center, const uint32_t* below, int width, uint32_t* row0, uint32_t* row1)
+{
+	/*
+		A B C
+		D E F -> E0 E1
+		G H I    E2 E3
+	*/
+	int x = 0;
+	for(; x + 4 <= width; x += 4)
+	{
+		__m128i B = _mm_loadu_si128((const __m128i*)(above + x));
+		__m128i D = _mm_loadu_si128((const __m128i*)(center + x - 1));
+		__m128i E = _mm_loadu_si128((const __m128i*)(center + x));
+		__m128i F = _mm_loadu_si128((const __m128i*)(center + x + 1));
+		__m128i H = _mm_loadu_si128((const __m128i*)(below + x));
+
+		__m128i prereq = _mm_andnot_si128(_mm_cmpeq_epi32(B, H), _notEqual(D, F));
+		__m128i E0 = _select(_mm_and_si128(prereq, _mm_cmpeq_epi32(D, B)), D, E);
+		__m128i E1 = _select(_mm_and_si128(prereq, _mm_cmpeq_epi32(B, F)), F, E);
+		__m128i E2 = _select(_mm_and_si128(prereq, _mm_cmpeq_epi32(D, H)), D, E);
+		__m128i E3 = _select(_mm_and_si128(prereq, _mm_cmpeq_epi32(H, F)), F, E);
+
+		_mm_storeu_si128((__m128i*)(row0 + 2*x), _mm_unpacklo_epi32(E0, E1));
+		_mm_storeu_si128((__m128i*)(row0 + 2*x + 4), _mm_unpackhi_epi32(E0, E1));
+		_mm_storeu_si128((__m128i*)(row1 + 2*x), _mm_unpacklo_epi32(E2, E3));
+		_mm_storeu_si128((__m128i*)(row1 + 2*x + 4), _mm_unpackhi_epi32(E2, E3));
+	}
+	return x;
+}
+
+int pp::scale3xRowSIMD(const uint32_t* above, const uint32_t* center, const uint32_t* below, int width, uint32_t* row0, uint32_t* row1, uint32_t* row2)
+{
+	/*
+		A B C    E0 E1 E2
+		D E F -> E3 E4 E5
+		G H I    E6 E7 E8
+	*/
+	int x = 0;
+	for(; x + 4 <= width; x += 4)
+	{
+		__m128i A = _mm_loadu_si128((const __m128i*)(above + x - 1));
+		__m128i B = _mm_loadu_si128((const __m128i*)(above + x));
+		__m128i C = _mm_loadu_si128((const __m128i*)(above + x + 1));
+		__m128i D = _mm_loadu_si128((const __m128i*)(center + x - 1));
+		__m128i E = _mm_loadu_si128((const __m128i*)(center + x));
+		__m128i F = _mm_loadu_si128((const __m128i*)(center + x + 1));
+		__m128i G = _mm_loadu_si128((const __m128i*)(below + x - 1));
+		__m128i H = _mm_loadu_si128((const __m128i*)(below + x));
+		__m128i I = _mm_loadu_si128((const __m128i*)(below + x + 1));
+
+		__m128i prereq = _mm_andnot_si128(_mm_cmpeq_epi32(B, H), _notEqual(D, F));
+		__m128i D_is_B = _mm_and_si128(prereq, _mm_cmpeq_epi32(D, B));
+		__m128i B_is_F = _mm_and_si128(prereq, _mm_cmpeq_epi32(B, F));
+		__m128i D_is_H = _mm_and_si128(prereq, _mm_cmpeq_epi32(D, H));
+		__m128i H_is_F = _mm_and_si128(prereq, _mm_cmpeq_epi32(H, F));
+		__m128i E_not_C = _notEqual(E, C);
+		__m128i E_not_G = _notEqual(E, G);
+		__m128i E_not_I = _notEqual(E, I);
+		__m128i E_not_A = _notEqual(E, A);
+
+		__m128i E0 = _select(D_is_B, D, E);
+		__m128i E1 = _select(_mm_or_si128(_mm_and_si128(D_is_B, E_not_C), _mm_and_si128(B_is_F, E_not_A)), B, E);
+		__m128i E2 = _select(B_is_F, F, E);
+		__m128i E3 = _select(_mm_or_si128(_mm_and_si128(D_is_B, E_not_G), _mm_and_si128(D_is_H, E_not_A)), D, E);
+		__m128i E5 = _select(_mm_or_si128(_mm_and_si128(B_is_F, E_not_I), _mm_and_si128(H_is_F, E_not_C)), F, E);
+		__m128i E6 = _select(D_is_H, D, E);
+		__m128i E7 = _select(_mm_or_si128(_mm_and_si128(D_is_H, E_not_I), _mm_and_si128(H_is_F, E_not_G)), H, E);
+		__m128i E8 = _select(H_is_F, F, E);
+
+		_storeInterleaved3(row0 + 3*x, E0, E1, E2);
+		_storeInterleaved3(row1 + 3*x, E3, E, E5);
+		_storeInterleaved3(row2 + 3*x, E6, E7, E8);
+	}
+	return x;
+}
+
+int pp::scale2xRowSIMD(const uint8_t* above, const uint8_t* center, const uint8_t* below, int width, uint8_t* row0, uint8_t* row1)
+{
+	//same as above, 16 indices at a time
+	int x = 0;
+	for(; x + 16 <= width; x += 16)
+	{
+		__m128i B = _mm_loadu_si128((const __m128i*)(above + x));
+		__m128i D = _mm_loadu_si128((const __m128i*)(center + x - 1));
+		__m128i E = _mm_loadu_si128((const __m128i*)(center + x));
+		__m128i F = _mm_loadu_si128((const __m128i*)(center + x + 1));
+		__m128i H = _mm_loadu_si128((const __m128i*)(below + x));
+
+		__m128i prereq = _mm_andnot_si128(_mm_cmpeq_epi8(B, H), _notEqualBytes(D, F));
+		__m128i E0 = _select(_mm_and_si128(prereq, _mm_cmpeq_epi8(D, B)), D, E);
+		__m128i E1 = _select(_mm_and_si128(prereq, _mm_cmpeq_epi8(B, F)), F, E);
+		__m128i E2 = _select(_mm_and_si128(prereq, _mm_cmpeq_epi8(D, H)), D, E);
+		__m128i E3 = _select(_mm_and_si128(prereq, _mm_cmpeq_epi8(H, F)), F, E);
+
+		_mm_storeu_si128((__m128i*)(row0 + 2*x), _mm_unpacklo_epi8(E0, E1));
+		_mm_storeu_si128((__m128i*)(row0 + 2*x + 16), _mm_unpackhi_epi8(E0, E1));
+		_mm_storeu_si128((__m128i*)(row1 + 2*x), _mm_unpacklo_epi8(E2, E3));
+		_mm_storeu_si128((__m128i*)(row1 + 2*x + 16), _mm_unpackhi_epi8(E2, E3));
+	}
+	return x;
+}
+
+int pp::scale3xRowSIMD(const uint8_t* above, const uint8_t* center, const uint8_t* below, int width, uint8_t* row0, uint8_t* row1, uint8_t* row2)
+{
+	//same as above, 16 indices at a time. SSE2 can't shuffle bytes, so they are interleaved one by one
+	int x = 0;
+	for(; x + 16 <= width; x += 16)
+	{
+		__m128i A = _mm_loadu_si128((const __m128i*)(above + x - 1));
+		__m128i B = _mm_loadu_si128((const __m128i*)(above + x));
+		__m128i C = _mm_loadu_si128((const __m128i*)(above + x + 1));
+		__m128i D = _mm_loadu_si128((const __m128i*)(center + x - 1));
+		__m128i E = _mm_loadu_si128((const __m128i*)(center + x));
+		__m128i F = _mm_loadu_si128((const __m128i*)(center + x + 1));
+		__m128i G = _mm_loadu_si128((const __m128i*)(below + x - 1));
+		__m128i H = _mm_loadu_si128((const __m128i*)(below + x));
+		__m128i I = _mm_loadu_si128((const __m128i*)(below + x + 1));
+
+		__m128i prereq = _mm_andnot_si128(_mm_cmpeq_epi8(B, H), _notEqualBytes(D, F));
+		__m128i D_is_B = _mm_and_si128(prereq, _mm_cmpeq_epi8(D, B));
+		__m128i B_is_F = _mm_and_si128(prereq, _mm_cmpeq_epi8(B, F));
+		__m128i D_is_H = _mm_and_si128(prereq, _mm_cmpeq_epi8(D, H));
+		__m128i H_is_F = _mm_and_si128(prereq, _mm_cmpeq_epi8(H, F));
+		__m128i E_not_C = _notEqualBytes(E, C);
+		__m128i E_not_G = _notEqualBytes(E, G);
+		__m128i E_not_I = _notEqualBytes(E, I);
+		__m128i E_not_A = _notEqualBytes(E, A);
+
+		__m128i out[9];
+		out[0] = _select(D_is_B, D, E);
+		out[1] = _select(_mm_or_si128(_mm_and_si128(D_is_B, E_not_C), _mm_and_si128(B_is_F, E_not_A)), B, E);
+		out[2] = _select(B_is_F, F, E);
+		out[3] = _select(_mm_or_si128(_mm_and_si128(D_is_B, E_not_G), _mm_and_si128(D_is_H, E_not_A)), D, E);
+		out[4] = E;
+		out[5] = _select(_mm_or_si128(_mm_and_si128(B_is_F, E_not_I), _mm_and_si128(H_is_F, E_not_C)), F, E);
+		out[6] = _select(D_is_H, D, E);
+		out[7] = _select(_mm_or_si128(_mm_and_si128(D_is_H, E_not_I), _mm_and_si128(H_is_F, E_not_G)), H, E);
+		out[8] = _select(H_is_F, F, E);
+
+		uint8_t* rows[3] = { row0 + 3*x, row1 + 3*x, row2 + 3*x };
+		const uint8_t* lanes = (const uint8_t*)out;
+		for(int r = 0; r < 3; r++)
+			for(int i = 0; i < 16; i++)
+				for(int k = 0; k < 3; k++)
+					rows[r][3*i + k] = lanes[(3*r + k) * 16 + i];
+	}
+	return x;
+}
+
+#else
+
+int pp::scale2xRowSIMD(const uint32_t* above, const uint32_t* center, const uint32_t* below, int width, uint32_t* row0, uint32_t* row1)
+{
+	return 0;
+}
+
+int pp::scale3xRowSIMD(const uint32_t* above, const uint32_t* center, const uint32_t* below, int width, uint32_t* row0, uint32_t* row1, uint32_t* row2)
+{
+	return 0;
+}
+
+int pp::scale2xRowSIMD(const uint8_t* above, const uint8_t* center, const uint8_t* below, int width, uint8_t* row0, uint8_t* row1)
+{
+	return 0;
+}
+
+int pp::scale3xRowSIMD(const uint8_t* above, const uint8_t* center, const uint8_t* below, int width, uint8_t* row0, uint8_t* row1, uint8_t* row2)
+{
+	return 0;
+}
+
+#endif
+
+void pp::fillRow(uint32_t* dest, int count, uint32_t value)
+{
+	int x = 0;
+#ifdef PP_SSE2
+	__m128i v = _mm_set1_epi32(value);
+	for(; x + 4 <= count; x += 4)
+		_mm_storeu_si128((__m128i*)(dest + x), v);
+#endif
+	for(; x < count; x++)
+		dest[x] = value;
+}
+
+void pp::fillRow(uint8_t* dest, int count, uint8_t value)
+{
+	memset(dest, value, count);
+}
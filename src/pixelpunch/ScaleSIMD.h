@@ -0,0 +1,22 @@
+#pragma once
+
+#include "cinder/Cinder.h"
+
+namespace pp 
+{
+	/*
+	Vectorized Scale2x/Scale3x for one row of packed pixels. above, center and below must be readable
+	from x = -1 to x = width (see LineBuffer). They process as many pixels from the start of the row as
+	fit into whole vectors and return that count, the caller finishes the remaining pixels. Output is
+	bit-identical to the scalar rules in PixelScale.cpp.
+	*/
+	int scale2xRowSIMD(const uint32_t* above, const uint32_t* center, const uint32_t* below, int width, uint32_t* row0, uint32_t* row1);
+	int scale3xRowSIMD(const uint32_t* above, const uint32_t* center, const uint32_t* below, int width, uint32_t* row0, uint32_t* row1, uint32_t* row2);
+	//the same for rows of palette indices (see IndexedImage)
+	int scale2xRowSIMD(const uint8_t* above, const uint8_t* center, const uint8_t* below, int width, uint8_t* row0, uint8_t* row1);
+	int scale3xRowSIMD(const uint8_t* above, const uint8_t* center, const uint8_t* below, int width, uint8_t* row0, uint8_t* row1, uint8_t* row2);
+
+	//sets count pixels to value, four at a time where SSE2 is available
+	void fillRow(uint32_t* dest, int count, uint32_t value);
+	void fillRow(uint8_t* dest, int count, uint8_t value);
+}